@@ -0,0 +1,232 @@
+// Times the vertex kernels of vxops.c at every level the CPU supports against
+// the plain loops they replaced, and checks that they agree with them
+#include "vxops.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define lmin(x, y) (((x) < (y)) ? (x) : (y))
+#define lmax(x, y) (((x) < (y)) ? (y) : (x))
+
+#define NR_VERTICES (1 << 22)
+#define NR_RUNS 7
+
+union FloatUintConversion {
+  float fl;
+  uint_least32_t ui;
+};
+
+struct Buffers {
+  struct DrawVertex *vxs;
+  uint32_t *colors;
+  struct DrawVertex *moved; // followed by the colours unpacked
+  uint32_t *unpacked;
+  int32_t *quantised;
+  uint32_t *records;
+  sfVector2f lo;
+  sfVector2f hi;
+};
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// The loops as they were written in main.c before the kernels
+
+static void loopBounds(struct Buffers *b) {
+  b->lo = b->vxs[0].position;
+  b->hi = b->vxs[0].position;
+  for (size_t i = 0; i < NR_VERTICES; ++i) {
+    b->lo.x = lmin(b->lo.x, b->vxs[i].position.x);
+    b->lo.y = lmin(b->lo.y, b->vxs[i].position.y);
+    b->hi.x = lmax(b->hi.x, b->vxs[i].position.x);
+    b->hi.y = lmax(b->hi.y, b->vxs[i].position.y);
+  }
+}
+
+static void loopTranslate(struct Buffers *b) {
+  for (size_t i = 0; i < NR_VERTICES; ++i) {
+    b->moved[i].position.x = b->vxs[i].position.x - b->lo.x;
+    b->moved[i].position.y = b->vxs[i].position.y - b->lo.y;
+  }
+}
+
+static void loopQuantise(struct Buffers *b) {
+  float step = 0.25f;
+  for (size_t i = 0; i < NR_VERTICES; ++i) {
+    float x = b->vxs[i].position.x - b->lo.x;
+    float y = b->vxs[i].position.y - b->lo.y;
+    b->quantised[2 * i] = (int32_t)lrintf(x / step);
+    b->quantised[2 * i + 1] = (int32_t)lrintf(y / step);
+  }
+}
+
+static void loopPack(struct Buffers *b) {
+  for (size_t i = 0; i < NR_VERTICES; ++i) {
+    union FloatUintConversion xconv;
+    union FloatUintConversion yconv;
+    xconv.fl = b->vxs[i].position.x;
+    yconv.fl = b->vxs[i].position.y;
+    b->records[3 * i] = xconv.ui;
+    b->records[3 * i + 1] = yconv.ui;
+    b->records[3 * i + 2] = b->colors[i];
+  }
+}
+
+static void loopUnpack(struct Buffers *b) {
+  for (size_t i = 0; i < NR_VERTICES; ++i) {
+    union FloatUintConversion xconv, yconv;
+    xconv.ui = b->records[3 * i];
+    yconv.ui = b->records[3 * i + 1];
+    sfVector2f pos_in = {xconv.fl, yconv.fl};
+    struct DrawVertex tmpVx = {pos_in};
+    b->moved[i] = tmpVx;
+    b->unpacked[i] = b->records[3 * i + 2];
+  }
+}
+
+static void kernelBounds(struct Buffers *b) {
+  vxBounds(b->vxs, NR_VERTICES, &b->lo, &b->hi);
+}
+
+static void kernelTranslate(struct Buffers *b) {
+  vxTransform(b->vxs, NR_VERTICES, b->lo, 1, b->moved);
+}
+
+static void kernelQuantise(struct Buffers *b) {
+  vxQuantise(b->vxs, NR_VERTICES, b->lo, 0.25f, b->quantised);
+}
+
+static void kernelPack(struct Buffers *b) {
+  vxPack(b->vxs, b->colors, NR_VERTICES, b->records);
+}
+
+static void kernelUnpack(struct Buffers *b) {
+  vxUnpack(b->records, NR_VERTICES, b->moved, b->unpacked);
+}
+
+struct Case {
+  const char *name;
+  void (*loop)(struct Buffers *);
+  void (*kernel)(struct Buffers *);
+  const void *(*result)(const struct Buffers *, size_t *);
+};
+
+static const void *boundsResult(const struct Buffers *b, size_t *size) {
+  *size = 2 * sizeof(sfVector2f);
+  return &b->lo;
+}
+
+static const void *movedResult(const struct Buffers *b, size_t *size) {
+  *size = NR_VERTICES * sizeof(struct DrawVertex);
+  return b->moved;
+}
+
+static const void *unpackedResult(const struct Buffers *b, size_t *size) {
+  *size = NR_VERTICES * (sizeof(struct DrawVertex) + sizeof(uint32_t));
+  return b->moved;
+}
+
+static const void *quantisedResult(const struct Buffers *b, size_t *size) {
+  *size = NR_VERTICES * 2 * sizeof(int32_t);
+  return b->quantised;
+}
+
+static const void *recordsResult(const struct Buffers *b, size_t *size) {
+  *size = NR_VERTICES * 3 * sizeof(uint32_t);
+  return b->records;
+}
+
+static double best(void (*run)(struct Buffers *), struct Buffers *b) {
+  double fastest = INFINITY;
+  for (int r = 0; r < NR_RUNS; ++r) {
+    double start = now();
+    run(b);
+    fastest = lmin(fastest, now() - start);
+  }
+  return fastest;
+}
+
+int main(void) {
+  static const char *const levels[] = {"scalar", "sse2", "avx2"};
+  struct Buffers b;
+  memset(&b, 0, sizeof(b));
+  b.vxs = malloc(NR_VERTICES * sizeof(struct DrawVertex));
+  b.colors = malloc(NR_VERTICES * sizeof(uint32_t));
+  b.moved =
+      malloc(NR_VERTICES * (sizeof(struct DrawVertex) + sizeof(uint32_t)));
+  b.quantised = malloc(NR_VERTICES * 2 * sizeof(int32_t));
+  b.records = malloc(NR_VERTICES * 3 * sizeof(uint32_t));
+  void *expected = malloc(NR_VERTICES * 3 * sizeof(uint32_t));
+  if (!b.vxs || !b.colors || !b.moved || !b.quantised || !b.records ||
+      !expected) {
+    fprintf(stderr, "Failed to allocate memory (line %d)\n", __LINE__);
+    return EXIT_FAILURE;
+  }
+  b.unpacked = (uint32_t *)(b.moved + NR_VERTICES);
+
+  // strokes wandering around like real ones do
+  srand(1);
+  sfVector2f pen = {0, 0};
+  for (size_t i = 0; i < NR_VERTICES; ++i) {
+    pen.x += rand() % 2001 / 100.f - 10;
+    pen.y += rand() % 2001 / 100.f - 10;
+    b.vxs[i].position = pen;
+    b.colors[i] = i % 2 ? b.colors[i - 1] : (uint32_t)rand() << 8 | 255;
+  }
+  loopBounds(&b);
+  loopPack(&b);
+
+  const struct Case cases[] = {
+      {"bounds", loopBounds, kernelBounds, boundsResult},
+      {"translate", loopTranslate, kernelTranslate, movedResult},
+      {"quantise", loopQuantise, kernelQuantise, quantisedResult},
+      {"pack", loopPack, kernelPack, recordsResult},
+      {"unpack", loopUnpack, kernelUnpack, unpackedResult},
+  };
+
+  printf("%d vertices, best of %d runs, ns per vertex\n\n", NR_VERTICES,
+         NR_RUNS);
+  printf("%-10s %8s", "kernel", "loop");
+  for (int l = 0; l <= (int)vxLevel(); ++l) {
+    printf(" %16s", levels[l]);
+  }
+  printf("\n");
+
+  int mismatches = 0;
+  enum VxLevel top = vxLevel();
+  for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); ++c) {
+    size_t size;
+    double base = best(cases[c].loop, &b);
+    const void *result = cases[c].result(&b, &size);
+    memcpy(expected, result, size);
+    printf("%-10s %8.3f", cases[c].name, base * 1e9 / NR_VERTICES);
+
+    for (int l = 0; l <= (int)top; ++l) {
+      vxLimitLevel((enum VxLevel)l);
+      double t = best(cases[c].kernel, &b);
+      int same = !memcmp(expected, result, size);
+      mismatches += !same;
+      printf(" %8.3f (%4.1fx)%s", t * 1e9 / NR_VERTICES, base / t,
+             same ? "" : "!");
+    }
+    vxLimitLevel(top);
+    printf("\n");
+  }
+
+  if (mismatches) {
+    printf("\n! differs from the loop\n");
+  }
+
+  free(expected);
+  free(b.records);
+  free(b.quantised);
+  free(b.moved);
+  free(b.colors);
+  free(b.vxs);
+  return mismatches ? EXIT_FAILURE : EXIT_SUCCESS;
+}
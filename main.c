@@ -1,16 +1,24 @@
 #include <SFML/Config.h>
 #include <SFML/Graphics/Color.h>
 #include <SFML/Graphics/PrimitiveType.h>
+#include <SFML/Graphics/RenderTexture.h>
 #include <SFML/Graphics/RenderWindow.h>
+#include <SFML/Graphics/Shader.h>
+#include <SFML/Graphics/Sprite.h>
 #include <SFML/Graphics/Types.h>
 #include <SFML/Graphics/Vertex.h>
 #include <SFML/Graphics/VertexBuffer.h>
 #include <SFML/Graphics/View.h>
+#include <SFML/OpenGL.h>
 #include <SFML/System/Clock.h>
 #include <SFML/System/InputStream.h>
+#include <SFML/System/Mutex.h>
+#include <SFML/System/Sleep.h>
+#include <SFML/System/Thread.h>
 #include <SFML/System/Types.h>
 #include <SFML/System/Vector2.h>
 #include <SFML/Window/Clipboard.h>
+#include <SFML/Window/Context.h>
 #include <SFML/Window/Cursor.h>
 #include <SFML/Window/Event.h>
 #include <SFML/Window/Mouse.h>
@@ -20,6 +28,7 @@
 #include <SFML/Window/WindowBase.h>
 #include <errno.h>
 #include <math.h>
+#include <stdatomic.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -27,6 +36,8 @@
 #include <string.h>
 #include <time.h>
 
+#include "vxops.h"
+
 #if defined(WIN32)
 #include <io.h>
 #define F_OK 0
@@ -40,11 +51,6 @@
 #define lmin(x, y) (((x) < (y)) ? (x) : (y))
 #define lmax(x, y) (((x) < (y)) ? (y) : (x))
 
-union FloatUintConversion {
-  float fl;
-  uint_least32_t ui;
-};
-
 int whateverEvent(int wait, sfRenderWindow *window, sfEvent *evt, int *enough) {
   if (wait) {
     *enough = 1;
@@ -55,7 +61,90 @@ int whateverEvent(int wait, sfRenderWindow *window, sfEvent *evt, int *enough) {
 
 #define SEC_TO_NS(sec) ((sec) * 1000000000)
 
-int save(const sfVertex *vertices, size_t sz, sfVector2u winSize) {
+// vertices converted at once by the vxops kernels while writing files
+#define VX_CHUNK 4096
+
+#define PALETTE_SIZE (1 << 16)
+#define PALETTE_SLOTS (1 << 17)
+
+// Every colour of the drawing. Both vertices of a segment share theirs, so
+// a 16-bit index in here per segment stands beside vxa. An index keeps its
+// colour for good, threads read the colours behind the indices they got.
+struct Palette {
+  sfColor *colors; // the first one is transparent
+  size_t nrColors;
+  sfUint32 *keys; // colour; zero, the transparent one, marks an empty slot
+  uint16_t *idxs;
+};
+
+uint16_t paletteIndex(struct Palette *palette, sfColor color) {
+  sfUint32 key = sfColor_toInteger(color);
+  size_t slot = (key * 2654435761u) % PALETTE_SLOTS;
+  if (!key) {
+    return 0;
+  }
+
+  while (palette->keys[slot]) {
+    if (palette->keys[slot] == key) {
+      return palette->idxs[slot];
+    }
+    slot = (slot + 1) % PALETTE_SLOTS;
+  }
+
+  if (palette->nrColors == PALETTE_SIZE) {
+    // the palette is full, settle for the closest colour
+    size_t best = 0;
+    long bestDist = -1;
+    for (size_t i = 0; i < palette->nrColors; ++i) {
+      long dr = (long)palette->colors[i].r - color.r;
+      long dg = (long)palette->colors[i].g - color.g;
+      long db = (long)palette->colors[i].b - color.b;
+      long da = (long)palette->colors[i].a - color.a;
+      long dist = dr * dr + dg * dg + db * db + da * da;
+      if (bestDist < 0 || dist < bestDist) {
+        best = i;
+        bestDist = dist;
+      }
+    }
+    return (uint16_t)best;
+  }
+
+  uint16_t idx = (uint16_t)palette->nrColors++;
+  palette->colors[idx] = color;
+  palette->keys[slot] = key;
+  palette->idxs[slot] = idx;
+  return idx;
+}
+
+int createPalette(struct Palette *palette) {
+  static const sfColor transparent = {0, 0, 0, 0};
+  palette->colors = (sfColor *)malloc(PALETTE_SIZE * sizeof(sfColor));
+  palette->keys = (sfUint32 *)calloc(PALETTE_SLOTS, sizeof(sfUint32));
+  palette->idxs = (uint16_t *)malloc(PALETTE_SLOTS * sizeof(uint16_t));
+  if (!palette->colors || !palette->keys || !palette->idxs) {
+    return 0;
+  }
+  palette->colors[0] = transparent;
+  palette->nrColors = 1;
+  return 1;
+}
+
+void destroyPalette(struct Palette *palette) {
+  free(palette->colors);
+  free(palette->keys);
+  free(palette->idxs);
+}
+
+// sfColor_toInteger of the colour of each of the n vertices from first on
+void colorWords(const uint16_t *segColors, const struct Palette *palette,
+                size_t first, size_t n, uint32_t *words) {
+  for (size_t k = 0; k < n; ++k) {
+    words[k] = sfColor_toInteger(palette->colors[segColors[(first + k) / 2]]);
+  }
+}
+
+int save(const struct DrawVertex *vertices, const uint16_t *segColors,
+         const struct Palette *palette, size_t sz, sfVector2u winSize) {
   for (;;) {
     unsigned long long nanoseconds;
     struct timespec ts;
@@ -82,140 +171,2591 @@ int save(const sfVertex *vertices, size_t sz, sfVector2u winSize) {
       continue;
     }
 
-    FILE *f = fopen(filename, "w");
-    if (!f) {
-      fprintf(stderr, "Failed to open the file %s\n", filename);
-      free(filename);
-      return 0;
-    }
+    FILE *f = fopen(filename, "w");
+    if (!f) {
+      fprintf(stderr, "Failed to open the file %s\n", filename);
+      free(filename);
+      return 0;
+    }
+
+    uint32_t words[VX_CHUNK];
+    uint32_t records[3 * VX_CHUNK];
+    for (size_t i = 0; i < sz; i += VX_CHUNK) {
+      size_t count = lmin(sz - i, VX_CHUNK);
+      colorWords(segColors, palette, i, count, words);
+      vxPack(vertices + i, words, count, records);
+      for (size_t k = 0; k < count; ++k) {
+        fprintf(f, "%u %u %u\n", records[3 * k], records[3 * k + 1],
+                records[3 * k + 2]);
+      }
+    }
+
+    fclose(f);
+    free(filename);
+    break;
+  }
+  return 1;
+}
+
+int exportSvg(const struct DrawVertex *vertices, const uint16_t *segColors,
+              const struct Palette *palette, size_t sz) {
+  sfVector2f leftTop;
+  sfVector2f rightBottom;
+  vxBounds(vertices, sz, &leftTop, &rightBottom);
+
+  sfVector2u winSize = {rightBottom.x - leftTop.x + 1,
+                        rightBottom.y - leftTop.y + 1};
+
+  for (;;) {
+    unsigned long long nanoseconds;
+    struct timespec ts;
+    int ret_code = clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    if (ret_code == -1) {
+      fprintf(stderr, "Failed to obtain timestamp. errno = %i: %s\n", errno,
+              strerror(errno));
+      nanoseconds = UINT64_MAX;
+      return 0;
+    } else {
+      nanoseconds = SEC_TO_NS((unsigned long long)ts.tv_sec) +
+                    (unsigned long long)ts.tv_nsec;
+    }
+
+    char *filename = (char *)malloc(50);
+    if (!filename) {
+      fprintf(stderr, "Failed to allocate memory (line %d)\n", __LINE__);
+      return 0;
+    }
+
+    sprintf(filename, "%llu.html", nanoseconds);
+    if (access(filename, F_OK) == 0) {
+      free(filename);
+      continue;
+    }
+
+    FILE *f = fopen(filename, "w");
+    if (!f) {
+      fprintf(stderr, "Failed to open the file %s\n", filename);
+      free(filename);
+      return 0;
+    }
+
+    fprintf(f,
+            "<!DOCTYPE html>\n<html>\n<body "
+            "style=\"background-color:#000000;\">\n<h1>svg</h1>\n"
+            "<svg width=\"%d\" height=\"%d\">\n",
+            winSize.x, winSize.y);
+
+    struct DrawVertex moved[VX_CHUNK];
+    for (size_t i = 0; i < sz / 2 * 2; i += VX_CHUNK) {
+      size_t count = lmin(sz / 2 * 2 - i, VX_CHUNK);
+      vxTransform(vertices + i, count, leftTop, 1, moved);
+
+      for (size_t k = 0; k < count; k += 2) {
+        sfVector2f tr_coords_0 = moved[k].position;
+        sfVector2f tr_coords_1 = moved[k + 1].position;
+        sfColor color = palette->colors[segColors[(i + k) / 2]];
+
+        fprintf(f,
+                "<line x1=\"%f\" y1=\"%f\" x2=\"%f"
+                "\" y2=\"%f\" "
+                "style=\"stroke:rgba(%d,%d,%d,%d);stroke-width:1\" />\n",
+                tr_coords_0.x, tr_coords_0.y, tr_coords_1.x, tr_coords_1.y,
+                (int)color.r, (int)color.g, (int)color.b, (int)color.a);
+      }
+    }
+
+    fprintf(f, "</svg>\n</body>\n</html>");
+
+    fclose(f);
+    free(filename);
+    break;
+  }
+  return 1;
+}
+
+struct Base64 {
+  FILE *f;
+  unsigned char pending[3];
+  int nrPending;
+};
+
+void base64Put(struct Base64 *b64, const void *data, size_t size) {
+  static const char digits[] =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  const unsigned char *bytes = (const unsigned char *)data;
+  for (size_t i = 0; i < size; ++i) {
+    b64->pending[b64->nrPending++] = bytes[i];
+    if (b64->nrPending == 3) {
+      unsigned long v = ((unsigned long)b64->pending[0] << 16) |
+                        ((unsigned long)b64->pending[1] << 8) |
+                        b64->pending[2];
+      char out[4] = {digits[v >> 18], digits[(v >> 12) & 63],
+                     digits[(v >> 6) & 63], digits[v & 63]};
+      fwrite(out, 1, 4, b64->f);
+      b64->nrPending = 0;
+    }
+  }
+}
+
+void base64End(struct Base64 *b64) {
+  static const char digits[] =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  if (!b64->nrPending) {
+    return;
+  }
+  unsigned long v = (unsigned long)b64->pending[0] << 16;
+  if (b64->nrPending == 2) {
+    v |= (unsigned long)b64->pending[1] << 8;
+  }
+  char out[4] = {digits[v >> 18], digits[(v >> 12) & 63],
+                 b64->nrPending == 2 ? digits[(v >> 6) & 63] : '=', '='};
+  fwrite(out, 1, 4, b64->f);
+  b64->nrPending = 0;
+}
+
+// typed arrays are read back as little endian
+void base64PutU32(struct Base64 *b64, sfUint32 v) {
+  unsigned char bytes[4] = {v & 255, (v >> 8) & 255, (v >> 16) & 255, v >> 24};
+  base64Put(b64, bytes, 4);
+}
+
+void base64PutU16(struct Base64 *b64, unsigned int v) {
+  unsigned char bytes[2] = {v & 255, (v >> 8) & 255};
+  base64Put(b64, bytes, 2);
+}
+
+// Decodes the embedded blobs and draws them onto a canvas with pan and zoom.
+// Segments are grouped in chunks with bounding boxes for culling; chunks
+// smaller than a pixel become a single dot and segments shorter than a pixel
+// are merged into their neighbours.
+static const char *const canvasScript =
+    "const geo = document.getElementById('positions');\n"
+    "const pal = document.getElementById('colors');\n"
+    "const canvas = document.getElementById('canvas');\n"
+    "const ctx = canvas.getContext('2d');\n"
+    "const n = +geo.dataset.segments;\n"
+    "const unit = +geo.dataset.step;\n"
+    "const CH = 1024;\n"
+    "// atob a slice at a time, browsers cap the size of data: URLs\n"
+    "const decode = el => {\n"
+    "  const t = el.textContent.trim(), S = 1 << 20;\n"
+    "  const pad = t.endsWith('==') ? 2 : t.endsWith('=') ? 1 : 0;\n"
+    "  const out = new Uint8Array(t.length / 4 * 3 - pad);\n"
+    "  for (let i = 0, o = 0; i < t.length; i += S) {\n"
+    "    const b = atob(t.slice(i, i + S));\n"
+    "    for (let j = 0; j < b.length; ++j) out[o++] = b.charCodeAt(j);\n"
+    "  }\n"
+    "  return out.buffer;\n"
+    "};\n"
+    "start(geo.dataset.format === 'u16' ? new Uint16Array(decode(geo)) :\n"
+    "  new Float32Array(decode(geo)), new Uint32Array(decode(pal)));\n"
+    "function start(pos, runs) {\n"
+    "  const nrCh = Math.ceil(n / CH), box = new Float32Array(nrCh * 4);\n"
+    "  for (let c = 0; c < nrCh; ++c) {\n"
+    "    let x0 = Infinity, y0 = Infinity, x1 = -Infinity, y1 = -Infinity;\n"
+    "    for (let i = c * CH * 4, e = Math.min(n, (c + 1) * CH) * 4; i < e;"
+    " i += 2) {\n"
+    "      x0 = Math.min(x0, pos[i]); x1 = Math.max(x1, pos[i]);\n"
+    "      y0 = Math.min(y0, pos[i + 1]); y1 = Math.max(y1, pos[i + 1]);\n"
+    "    }\n"
+    "    box.set([x0 * unit, y0 * unit, x1 * unit, y1 * unit], c * 4);\n"
+    "  }\n"
+    "  const nrRuns = runs.length / 2, runEnd = new Float64Array(nrRuns);\n"
+    "  const style = [];\n"
+    "  for (let r = 0, s = 0; r < nrRuns; ++r) {\n"
+    "    runEnd[r] = s += runs[2 * r];\n"
+    "    const c = runs[2 * r + 1];\n"
+    "    style.push('rgba(' + (c >>> 24) + ',' + (c >>> 16 & 255) + ',' +\n"
+    "      (c >>> 8 & 255) + ',' + (c & 255) / 255 + ')');\n"
+    "  }\n"
+    "  const runOf = i => {\n"
+    "    let lo = 0, hi = nrRuns - 1;\n"
+    "    while (lo < hi) {\n"
+    "      const mid = (lo + hi) >> 1;\n"
+    "      if (runEnd[mid] > i) hi = mid; else lo = mid + 1;\n"
+    "    }\n"
+    "    return lo;\n"
+    "  };\n"
+    "  const dpr = window.devicePixelRatio || 1;\n"
+    "  const width = +geo.dataset.width, height = +geo.dataset.height;\n"
+    "  let zoom = 1, ox = 0, oy = 0, pending = false, drag = null;\n"
+    "  function resize() {\n"
+    "    canvas.width = innerWidth * dpr;\n"
+    "    canvas.height = innerHeight * dpr;\n"
+    "    redraw();\n"
+    "  }\n"
+    "  function draw() {\n"
+    "    const w = canvas.width, h = canvas.height, k = zoom * unit;\n"
+    "    ctx.fillStyle = '#12141f';\n"
+    "    ctx.fillRect(0, 0, w, h);\n"
+    "    ctx.lineWidth = dpr;\n"
+    "    for (let c = 0; c < nrCh; ++c) {\n"
+    "      const bx0 = box[4 * c] * zoom + ox, by0 = box[4 * c + 1] * zoom +"
+    " oy;\n"
+    "      const bx1 = box[4 * c + 2] * zoom + ox, by1 = box[4 * c + 3] * "
+    "zoom + oy;\n"
+    "      if (bx1 < 0 || by1 < 0 || bx0 > w || by0 > h) continue;\n"
+    "      const first = c * CH, last = Math.min(n, first + CH);\n"
+    "      let r = runOf(first);\n"
+    "      if (bx1 - bx0 < 1 && by1 - by0 < 1) {\n"
+    "        ctx.fillStyle = style[r];\n"
+    "        ctx.fillRect(bx0, by0, dpr, dpr);\n"
+    "        continue;\n"
+    "      }\n"
+    "      let lx = NaN, ly = NaN;\n"
+    "      ctx.strokeStyle = style[r];\n"
+    "      ctx.beginPath();\n"
+    "      for (let i = first; i < last; ++i) {\n"
+    "        if (i >= runEnd[r]) {\n"
+    "          ctx.stroke();\n"
+    "          while (i >= runEnd[r]) ++r;\n"
+    "          ctx.strokeStyle = style[r];\n"
+    "          ctx.beginPath();\n"
+    "          lx = NaN;\n"
+    "        }\n"
+    "        const x0 = pos[4 * i] * k + ox, y0 = pos[4 * i + 1] * k + oy;\n"
+    "        const x1 = pos[4 * i + 2] * k + ox, y1 = pos[4 * i + 3] * k + "
+    "oy;\n"
+    "        let moved = false;\n"
+    "        if (!(Math.abs(x0 - lx) < 0.5 && Math.abs(y0 - ly) < 0.5)) {\n"
+    "          ctx.moveTo(x0, y0);\n"
+    "          lx = x0; ly = y0; moved = true;\n"
+    "        }\n"
+    "        if (moved || Math.abs(x1 - lx) >= 1 || Math.abs(y1 - ly) >= 1) {"
+    "\n"
+    "          ctx.lineTo(x1, y1);\n"
+    "          lx = x1; ly = y1;\n"
+    "        }\n"
+    "      }\n"
+    "      ctx.stroke();\n"
+    "    }\n"
+    "  }\n"
+    "  function redraw() {\n"
+    "    if (pending) return;\n"
+    "    pending = true;\n"
+    "    requestAnimationFrame(() => { pending = false; draw(); });\n"
+    "  }\n"
+    "  canvas.addEventListener('mousedown', e => drag = [e.clientX, "
+    "e.clientY]);\n"
+    "  addEventListener('mouseup', () => drag = null);\n"
+    "  addEventListener('mousemove', e => {\n"
+    "    if (!drag) return;\n"
+    "    ox += (e.clientX - drag[0]) * dpr;\n"
+    "    oy += (e.clientY - drag[1]) * dpr;\n"
+    "    drag = [e.clientX, e.clientY];\n"
+    "    redraw();\n"
+    "  });\n"
+    "  canvas.addEventListener('wheel', e => {\n"
+    "    e.preventDefault();\n"
+    "    const f = Math.exp(-e.deltaY / 300);\n"
+    "    const mx = e.clientX * dpr, my = e.clientY * dpr;\n"
+    "    ox = mx - (mx - ox) * f;\n"
+    "    oy = my - (my - oy) * f;\n"
+    "    zoom *= f;\n"
+    "    redraw();\n"
+    "  }, {passive: false});\n"
+    "  addEventListener('resize', resize);\n"
+    "  resize();\n"
+    "  zoom = Math.min(canvas.width / width, canvas.height / height) * 0.95;\n"
+    "  ox = (canvas.width - width * zoom) / 2;\n"
+    "  oy = (canvas.height - height * zoom) / 2;\n"
+    "}\n";
+
+// Exports the segments as a packed binary blob drawn by a small script,
+// which stays usable far beyond the sizes exportSvg can handle
+int exportCanvas(const struct DrawVertex *vertices, const uint16_t *segColors,
+                 const struct Palette *palette, size_t sz) {
+  size_t nrSegs = sz / 2;
+  sfVector2f leftTop;
+  sfVector2f rightBottom;
+  vxBounds(vertices, nrSegs * 2, &leftTop, &rightBottom);
+
+  // 16-bit coordinates as long as they keep a quarter of a unit
+  float extent = lmax(rightBottom.x - leftTop.x, rightBottom.y - leftTop.y);
+  int packed = extent / 65535 <= 0.25f;
+  float step = packed ? lmax(extent / 65535, 1e-6f) : 1;
+
+  for (;;) {
+    unsigned long long nanoseconds;
+    struct timespec ts;
+    int ret_code = clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    if (ret_code == -1) {
+      fprintf(stderr, "Failed to obtain timestamp. errno = %i: %s\n", errno,
+              strerror(errno));
+      nanoseconds = UINT64_MAX;
+      return 0;
+    } else {
+      nanoseconds = SEC_TO_NS((unsigned long long)ts.tv_sec) +
+                    (unsigned long long)ts.tv_nsec;
+    }
+
+    char *filename = (char *)malloc(50);
+    if (!filename) {
+      fprintf(stderr, "Failed to allocate memory (line %d)\n", __LINE__);
+      return 0;
+    }
+
+    sprintf(filename, "%llu.html", nanoseconds);
+    if (access(filename, F_OK) == 0) {
+      free(filename);
+      continue;
+    }
+
+    FILE *f = fopen(filename, "w");
+    if (!f) {
+      fprintf(stderr, "Failed to open the file %s\n", filename);
+      free(filename);
+      return 0;
+    }
+
+    fprintf(f,
+            "<!DOCTYPE html>\n<html>\n<body style=\"margin:0;overflow:hidden;"
+            "background-color:#12141f;\">\n"
+            "<canvas id=\"canvas\" style=\"display:block;width:100vw;"
+            "height:100vh;\"></canvas>\n"
+            "<script id=\"positions\" type=\"application/octet-stream\" "
+            "data-segments=\"%zu\" data-format=\"%s\" data-step=\"%.9g\" "
+            "data-width=\"%.9g\" data-height=\"%.9g\">\n",
+            nrSegs, packed ? "u16" : "f32", step,
+            rightBottom.x - leftTop.x + 1, rightBottom.y - leftTop.y + 1);
+
+    struct Base64 b64 = {f, {0, 0, 0}, 0};
+    for (size_t i = 0; i < nrSegs * 2; i += VX_CHUNK) {
+      size_t count = lmin(nrSegs * 2 - i, VX_CHUNK);
+      if (packed) {
+        int32_t quantised[2 * VX_CHUNK];
+        vxQuantise(vertices + i, count, leftTop, step, quantised);
+        for (size_t k = 0; k < 2 * count; ++k) {
+          base64PutU16(&b64, (unsigned int)quantised[k]);
+        }
+      } else {
+        struct DrawVertex moved[VX_CHUNK];
+        vxTransform(vertices + i, count, leftTop, 1, moved);
+        for (size_t k = 0; k < count; ++k) {
+          uint32_t bits[2];
+          memcpy(bits, &moved[k].position, sizeof(bits));
+          base64PutU32(&b64, bits[0]);
+          base64PutU32(&b64, bits[1]);
+        }
+      }
+    }
+    base64End(&b64);
+
+    fprintf(f, "\n</script>\n<script id=\"colors\" "
+               "type=\"application/octet-stream\">\n");
+
+    // pairs of segment count and colour
+    for (size_t i = 0; i < nrSegs;) {
+      size_t count = 1;
+      while (i + count < nrSegs && segColors[i + count] == segColors[i]) {
+        ++count;
+      }
+      base64PutU32(&b64, count);
+      base64PutU32(&b64, sfColor_toInteger(palette->colors[segColors[i]]));
+      i += count;
+    }
+    base64End(&b64);
+
+    fprintf(f, "\n</script>\n<script>\n%s</script>\n</body>\n</html>",
+            canvasScript);
+
+    fclose(f);
+    free(filename);
+    break;
+  }
+  return 1;
+}
+
+int save_to(const char *filename, const struct DrawVertex *vertices,
+            const uint16_t *segColors, const struct Palette *palette,
+            size_t sz, sfVector2u winSize) {
+  FILE *f = fopen(filename, "w");
+  if (!f) {
+    fprintf(stderr, "Failed to open the file %s\n", filename);
+    return 0;
+  }
+
+  uint32_t words[VX_CHUNK];
+  uint32_t records[3 * VX_CHUNK];
+  for (size_t i = 0; i < sz; i += VX_CHUNK) {
+    size_t count = lmin(sz - i, VX_CHUNK);
+    colorWords(segColors, palette, i, count, words);
+    vxPack(vertices + i, words, count, records);
+    for (size_t k = 0; k < count; ++k) {
+      fprintf(f, "%d %d %d\n", records[3 * k], records[3 * k + 1],
+              records[3 * k + 2]);
+    }
+  }
+
+  fclose(f);
+  return 1;
+}
+
+struct Loader {
+  FILE *fin;
+  struct DrawVertex *vertices;
+  uint16_t *segColors;
+  struct Palette *palette; // left to the loader until it is done
+  size_t capacity;
+  sfMutex *mutex;
+  size_t nrParsed; // guarded by mutex
+  int done;        // guarded by mutex
+  int stop;        // guarded by mutex
+};
+
+// Gives each segment starting among the n vertices from first the colour of
+// its first vertex; runs of one colour are the norm
+void colorSegments(struct Loader *ld, const uint32_t *words, size_t first,
+                   size_t n) {
+  uint16_t idx = 0;
+  for (size_t k = first % 2; k < n; k += 2) {
+    if (k < 2 || words[k] != words[k - 2]) {
+      idx = paletteIndex(ld->palette, sfColor_fromInteger(words[k]));
+    }
+    ld->segColors[(first + k) / 2] = idx;
+  }
+}
+
+// Parses the drawing on a separate thread so that the window can show up
+// immediately; the parsed prefix is published in chunks through nrParsed.
+void loadVertices(void *userData) {
+  struct Loader *ld = (struct Loader *)userData;
+  const size_t publishEvery = 1 << 14;
+  size_t n = 0;
+  size_t nrRecords = 0;
+  int stop = 0;
+  uint32_t records[3 * VX_CHUNK];
+  uint32_t words[VX_CHUNK];
+
+  while (!stop && n + nrRecords < ld->capacity &&
+         3 == fscanf(ld->fin, "%d %d %d\n", &records[3 * nrRecords],
+                     &records[3 * nrRecords + 1],
+                     &records[3 * nrRecords + 2])) {
+    if (++nrRecords < VX_CHUNK) {
+      continue;
+    }
+    vxUnpack(records, nrRecords, ld->vertices + n, words);
+    colorSegments(ld, words, n, nrRecords);
+    n += nrRecords;
+    nrRecords = 0;
+
+    if (n % publishEvery == 0) {
+      sfMutex_lock(ld->mutex);
+      ld->nrParsed = n;
+      stop = ld->stop;
+      sfMutex_unlock(ld->mutex);
+    }
+  }
+
+  vxUnpack(records, nrRecords, ld->vertices + n, words);
+  colorSegments(ld, words, n, nrRecords);
+  n += nrRecords;
+  fclose(ld->fin);
+
+  sfMutex_lock(ld->mutex);
+  ld->fin = NULL;
+  ld->nrParsed = n;
+  ld->done = 1;
+  sfMutex_unlock(ld->mutex);
+}
+
+// Keys touching the vertex history, ignored until the drawing is loaded
+int historyKey(sfKeyEvent key) {
+  switch (key.code) {
+  case sfKeyLeft:
+  case sfKeyRight:
+  case sfKeyUp:
+  case sfKeyDown:
+    return 1;
+  case sfKeyS:
+  case sfKeyE:
+  case sfKeyZ:
+    return key.control;
+  case sfKeyR:
+  case sfKeyF:
+    return key.alt;
+  default:
+    return 0;
+  }
+}
+
+#define GPU_RUN_MAX (1 << 14)
+#define GPU_STAGING (1 << 16)
+#define PALETTE_SIDE 256 // PALETTE_SIDE^2 == PALETTE_SIZE
+
+// Compact GPU vertex: a position quantised relative to the origin of its run
+// and an index into the colour palette
+struct GpuVertex {
+  int16_t x;
+  int16_t y;
+  uint16_t color;
+};
+
+// A contiguous range of vertices sharing the same quantisation grid
+struct GpuRun {
+  size_t first;
+  size_t count;
+  sfVector2f origin;
+  float step;
+  sfVector2f lo; // bounding box, possibly larger than the actual content
+  sfVector2f hi;
+  float finest; // length of the shortest non-degenerate segment
+};
+
+#ifndef APIENTRY
+#define APIENTRY
+#endif
+
+// Past OpenGL 1.1, which is all the Windows headers know about
+#ifndef GL_ARRAY_BUFFER
+#define GL_TEXTURE0 0x84C0
+#define GL_ARRAY_BUFFER 0x8892
+#define GL_DYNAMIC_DRAW 0x88E8
+#define GL_FRAGMENT_SHADER 0x8B30
+#define GL_VERTEX_SHADER 0x8B31
+#define GL_COMPILE_STATUS 0x8B81
+#define GL_LINK_STATUS 0x8B82
+#endif
+
+// OpenGL 2.0 entry points of the compact path. Every libGL exports 1.1 only
+// (opengl32 on Windows stops there), so these get looked up at runtime.
+struct GlFunctions {
+  void(APIENTRY *activeTexture)(GLenum);
+  void(APIENTRY *attachShader)(GLuint, GLuint);
+  void(APIENTRY *bindAttribLocation)(GLuint, GLuint, const char *);
+  void(APIENTRY *bindBuffer)(GLenum, GLuint);
+  void(APIENTRY *blendFuncSeparate)(GLenum, GLenum, GLenum, GLenum);
+  void(APIENTRY *bufferData)(GLenum, ptrdiff_t, const void *, GLenum);
+  void(APIENTRY *bufferSubData)(GLenum, ptrdiff_t, ptrdiff_t, const void *);
+  void(APIENTRY *compileShader)(GLuint);
+  GLuint(APIENTRY *createProgram)(void);
+  GLuint(APIENTRY *createShader)(GLenum);
+  void(APIENTRY *deleteBuffers)(GLsizei, const GLuint *);
+  void(APIENTRY *deleteProgram)(GLuint);
+  void(APIENTRY *deleteShader)(GLuint);
+  void(APIENTRY *disableVertexAttribArray)(GLuint);
+  void(APIENTRY *enableVertexAttribArray)(GLuint);
+  void(APIENTRY *genBuffers)(GLsizei, GLuint *);
+  void(APIENTRY *getProgramiv)(GLuint, GLenum, GLint *);
+  void(APIENTRY *getShaderInfoLog)(GLuint, GLsizei, GLsizei *, char *);
+  void(APIENTRY *getShaderiv)(GLuint, GLenum, GLint *);
+  GLint(APIENTRY *getUniformLocation)(GLuint, const char *);
+  void(APIENTRY *linkProgram)(GLuint);
+  void(APIENTRY *shaderSource)(GLuint, GLsizei, const char *const *,
+                               const GLint *);
+  void(APIENTRY *uniform1f)(GLint, GLfloat);
+  void(APIENTRY *uniform1i)(GLint, GLint);
+  void(APIENTRY *uniform2f)(GLint, GLfloat, GLfloat);
+  void(APIENTRY *uniformMatrix4fv)(GLint, GLsizei, GLboolean,
+                                   const GLfloat *);
+  void(APIENTRY *useProgram)(GLuint);
+  void(APIENTRY *vertexAttribPointer)(GLuint, GLint, GLenum, GLboolean,
+                                      GLsizei, const void *);
+};
+
+#define GL_FUNCTION(field, name)                                              \
+  do {                                                                         \
+    void (*fn)(void) = sfContext_getFunction(name);                            \
+    memcpy(&gl->field, &fn, sizeof(fn));                                       \
+    found = found && fn;                                                       \
+  } while (0)
+
+// Needs the context of the calling thread to be active
+int loadGlFunctions(struct GlFunctions *gl) {
+  int found = 1;
+  GL_FUNCTION(activeTexture, "glActiveTexture");
+  GL_FUNCTION(attachShader, "glAttachShader");
+  GL_FUNCTION(bindAttribLocation, "glBindAttribLocation");
+  GL_FUNCTION(bindBuffer, "glBindBuffer");
+  GL_FUNCTION(blendFuncSeparate, "glBlendFuncSeparate");
+  GL_FUNCTION(bufferData, "glBufferData");
+  GL_FUNCTION(bufferSubData, "glBufferSubData");
+  GL_FUNCTION(compileShader, "glCompileShader");
+  GL_FUNCTION(createProgram, "glCreateProgram");
+  GL_FUNCTION(createShader, "glCreateShader");
+  GL_FUNCTION(deleteBuffers, "glDeleteBuffers");
+  GL_FUNCTION(deleteProgram, "glDeleteProgram");
+  GL_FUNCTION(deleteShader, "glDeleteShader");
+  GL_FUNCTION(disableVertexAttribArray, "glDisableVertexAttribArray");
+  GL_FUNCTION(enableVertexAttribArray, "glEnableVertexAttribArray");
+  GL_FUNCTION(genBuffers, "glGenBuffers");
+  GL_FUNCTION(getProgramiv, "glGetProgramiv");
+  GL_FUNCTION(getShaderInfoLog, "glGetShaderInfoLog");
+  GL_FUNCTION(getShaderiv, "glGetShaderiv");
+  GL_FUNCTION(getUniformLocation, "glGetUniformLocation");
+  GL_FUNCTION(linkProgram, "glLinkProgram");
+  GL_FUNCTION(shaderSource, "glShaderSource");
+  GL_FUNCTION(uniform1f, "glUniform1f");
+  GL_FUNCTION(uniform1i, "glUniform1i");
+  GL_FUNCTION(uniform2f, "glUniform2f");
+  GL_FUNCTION(uniformMatrix4fv, "glUniformMatrix4fv");
+  GL_FUNCTION(useProgram, "glUseProgram");
+  GL_FUNCTION(vertexAttribPointer, "glVertexAttribPointer");
+  return found;
+}
+
+struct Gpu {
+  int compact;
+  size_t size;
+  void *staging;
+
+  // ranges of vertices with their bounding boxes, used for culling too
+  struct GpuRun *runs;
+  size_t nrRuns;
+  size_t capRuns;
+
+  // sfVertexBuffer path, used when shaders are not available
+  sfVertexBuffer *vxb;
+
+  // compact path
+  struct GlFunctions gl;
+  GLuint program;
+  GLuint vbo;
+  GLuint palette;
+  GLint originLoc;
+  GLint stepLoc;
+  GLint transformLoc;
+  GLint paletteLoc;
+  size_t nrColors; // of the palette, uploaded so far
+};
+
+static const char *const gpuVertexShader =
+    "#version 120\n"
+    "attribute vec2 position;\n"
+    "attribute float color;\n"
+    "uniform vec2 origin;\n"
+    "uniform float step;\n"
+    "uniform mat4 transform;\n"
+    "varying float paletteIdx;\n"
+    "void main() {\n"
+    "  gl_Position = transform * vec4(origin + position * step, 0.0, 1.0);\n"
+    "  paletteIdx = color;\n"
+    "}\n";
+
+static const char *const gpuFragmentShader =
+    "#version 120\n"
+    "uniform sampler2D palette;\n"
+    "varying float paletteIdx;\n"
+    "void main() {\n"
+    "  float idx = floor(paletteIdx + 0.5);\n"
+    "  vec2 cell = vec2(mod(idx, 256.0), floor(idx / 256.0));\n"
+    "  gl_FragColor = texture2D(palette, (cell + 0.5) / 256.0);\n"
+    "}\n";
+
+GLuint compileShader(const struct GlFunctions *gl, GLenum type,
+                     const char *source) {
+  GLuint shader = gl->createShader(type);
+  GLint ok = GL_FALSE;
+  if (!shader) {
+    return 0;
+  }
+  gl->shaderSource(shader, 1, &source, NULL);
+  gl->compileShader(shader);
+  gl->getShaderiv(shader, GL_COMPILE_STATUS, &ok);
+  if (ok != GL_TRUE) {
+    char log[512];
+    gl->getShaderInfoLog(shader, sizeof(log), NULL, log);
+    fprintf(stderr, "Failed to compile the shader: %s\n", log);
+    gl->deleteShader(shader);
+    return 0;
+  }
+  return shader;
+}
+
+int createCompactGpu(struct Gpu *gpu, size_t capacity) {
+  const struct GlFunctions *gl = &gpu->gl;
+  GLuint vs = compileShader(gl, GL_VERTEX_SHADER, gpuVertexShader);
+  GLuint fs = compileShader(gl, GL_FRAGMENT_SHADER, gpuFragmentShader);
+  GLint ok = GL_FALSE;
+
+  if (vs && fs) {
+    gpu->program = gl->createProgram();
+  }
+  if (gpu->program) {
+    gl->attachShader(gpu->program, vs);
+    gl->attachShader(gpu->program, fs);
+    gl->bindAttribLocation(gpu->program, 0, "position");
+    gl->bindAttribLocation(gpu->program, 1, "color");
+    gl->linkProgram(gpu->program);
+    gl->getProgramiv(gpu->program, GL_LINK_STATUS, &ok);
+  }
+  gl->deleteShader(vs);
+  gl->deleteShader(fs);
+  if (ok != GL_TRUE) {
+    return 0;
+  }
+
+  gpu->originLoc = gl->getUniformLocation(gpu->program, "origin");
+  gpu->stepLoc = gl->getUniformLocation(gpu->program, "step");
+  gpu->transformLoc = gl->getUniformLocation(gpu->program, "transform");
+  gpu->paletteLoc = gl->getUniformLocation(gpu->program, "palette");
+
+  while (glGetError() != GL_NO_ERROR) {
+  }
+
+  gl->genBuffers(1, &gpu->vbo);
+  gl->bindBuffer(GL_ARRAY_BUFFER, gpu->vbo);
+  gl->bufferData(GL_ARRAY_BUFFER, capacity * sizeof(struct GpuVertex), NULL,
+                 GL_DYNAMIC_DRAW);
+  gl->bindBuffer(GL_ARRAY_BUFFER, 0);
+
+  glGenTextures(1, &gpu->palette);
+  glBindTexture(GL_TEXTURE_2D, gpu->palette);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, PALETTE_SIDE, PALETTE_SIDE, 0,
+               GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  if (glGetError() != GL_NO_ERROR) {
+    fprintf(stderr, "Failed to allocate the compact vertex buffer\n");
+    return 0;
+  }
+
+  gpu->staging = malloc(GPU_STAGING * sizeof(struct GpuVertex));
+  return gpu->staging != NULL;
+}
+
+void destroyGpu(struct Gpu *gpu) {
+  if (gpu->program) {
+    gpu->gl.deleteProgram(gpu->program);
+  }
+  if (gpu->vbo) {
+    gpu->gl.deleteBuffers(1, &gpu->vbo);
+  }
+  if (gpu->palette) {
+    glDeleteTextures(1, &gpu->palette);
+  }
+  sfVertexBuffer_destroy(gpu->vxb);
+  free(gpu->runs);
+  free(gpu->staging);
+  memset(gpu, 0, sizeof(*gpu));
+}
+
+// Prefers the compact vertex layout and falls back to sfVertexBuffer when
+// shaders cannot be used
+int createGpu(struct Gpu *gpu, size_t capacity) {
+  memset(gpu, 0, sizeof(*gpu));
+
+  if (sfShader_isAvailable() && loadGlFunctions(&gpu->gl) &&
+      createCompactGpu(gpu, capacity)) {
+    gpu->compact = 1;
+    return 1;
+  }
+  destroyGpu(gpu);
+
+  gpu->vxb = sfVertexBuffer_create(capacity, sfLines, sfVertexBufferStream);
+  gpu->staging = malloc(GPU_STAGING * sizeof(sfVertex));
+  return gpu->vxb && gpu->staging;
+}
+
+// Uploads the palette up to the colour idx, the ones before it are set too
+void syncPalette(struct Gpu *gpu, const struct Palette *palette,
+                 uint16_t idx) {
+  glBindTexture(GL_TEXTURE_2D, gpu->palette);
+  while (gpu->nrColors <= idx) {
+    size_t x = gpu->nrColors % PALETTE_SIDE;
+    size_t n = lmin(PALETTE_SIDE - x, (size_t)idx + 1 - gpu->nrColors);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, x, gpu->nrColors / PALETTE_SIDE, n, 1,
+                    GL_RGBA, GL_UNSIGNED_BYTE, palette->colors + gpu->nrColors);
+    gpu->nrColors += n;
+  }
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+int runFits(const struct GpuRun *run, sfVector2f lo, sfVector2f hi) {
+  float reach = 32000 * run->step;
+  return lo.x >= run->origin.x - reach && hi.x <= run->origin.x + reach &&
+         lo.y >= run->origin.y - reach && hi.y <= run->origin.y + reach;
+}
+
+// Picks the finest power-of-two grid covering the bounding box of the run.
+// Origins are snapped to the grid so that neighbouring runs tend to share
+// them and can be drawn together.
+void placeRun(struct GpuRun *run) {
+  float half = lmax(run->hi.x - run->lo.x, run->hi.y - run->lo.y) / 2;
+  float step = 1.f / 4096;
+  while (half > 16000 * step && step < 1e30f) {
+    step *= 2;
+  }
+  float snap = step * 16384;
+  run->step = step;
+  run->origin.x = roundf((run->lo.x + run->hi.x) / 2 / snap) * snap;
+  run->origin.y = roundf((run->lo.y + run->hi.y) / 2 / snap) * snap;
+}
+
+int reserveRuns(struct Gpu *gpu, size_t n) {
+  if (gpu->nrRuns + n > gpu->capRuns) {
+    size_t cap = gpu->capRuns ? gpu->capRuns * 2 : 1024;
+    while (gpu->nrRuns + n > cap) {
+      cap *= 2;
+    }
+    struct GpuRun *runs =
+        (struct GpuRun *)realloc(gpu->runs, cap * sizeof(struct GpuRun));
+    if (!runs) {
+      return 0;
+    }
+    gpu->runs = runs;
+    gpu->capRuns = cap;
+  }
+  return 1;
+}
+
+struct GpuRun *pushRun(struct Gpu *gpu, size_t first) {
+  if (!reserveRuns(gpu, 1)) {
+    return NULL;
+  }
+  struct GpuRun *run = &gpu->runs[gpu->nrRuns++];
+  memset(run, 0, sizeof(*run));
+  run->first = first;
+  run->finest = INFINITY;
+  return run;
+}
+
+// Assigns the segments in [first, end) to runs and returns the lowest vertex
+// whose encoding changed
+size_t layoutRuns(struct Gpu *gpu, const struct DrawVertex *vxa, size_t first,
+                  size_t end) {
+  size_t dirty = first;
+
+  while (gpu->nrRuns && gpu->runs[gpu->nrRuns - 1].first >= first) {
+    --gpu->nrRuns;
+  }
+  if (gpu->nrRuns) {
+    struct GpuRun *last = &gpu->runs[gpu->nrRuns - 1];
+    last->count = lmin(last->count, first - last->first);
+  }
+
+  for (size_t i = first; i < end; i += 2) {
+    size_t n = lmin(end - i, 2);
+    sfVector2f a = vxa[i].position;
+    sfVector2f b = vxa[i + n - 1].position;
+    sfVector2f lo = {lmin(a.x, b.x), lmin(a.y, b.y)};
+    sfVector2f hi = {lmax(a.x, b.x), lmax(a.y, b.y)};
+    float len = hypotf(b.x - a.x, b.y - a.y);
+    struct GpuRun *run = gpu->nrRuns ? &gpu->runs[gpu->nrRuns - 1] : NULL;
+    int append = 0;
+
+    if (run && run->count + n <= GPU_RUN_MAX) {
+      // short segments drawn deep inside a zoom get a finer grid of their own
+      int fine = len == 0 || len >= 8 * run->step;
+      if (runFits(run, lo, hi)) {
+        append = fine;
+      } else if (fine) {
+        struct GpuRun merged = *run;
+        merged.lo.x = lmin(merged.lo.x, lo.x);
+        merged.lo.y = lmin(merged.lo.y, lo.y);
+        merged.hi.x = lmax(merged.hi.x, hi.x);
+        merged.hi.y = lmax(merged.hi.y, hi.y);
+        placeRun(&merged);
+        if (merged.finest >= 8 * merged.step) {
+          *run = merged;
+          dirty = lmin(dirty, run->first);
+          append = 1;
+        }
+      }
+    }
+
+    if (append) {
+      run->lo.x = lmin(run->lo.x, lo.x);
+      run->lo.y = lmin(run->lo.y, lo.y);
+      run->hi.x = lmax(run->hi.x, hi.x);
+      run->hi.y = lmax(run->hi.y, hi.y);
+    } else {
+      // growing the runs would leave a pointer to the previous one dangling
+      if (!reserveRuns(gpu, 1)) {
+        return SIZE_MAX;
+      }
+      struct GpuRun *prev = run ? &gpu->runs[gpu->nrRuns - 1] : NULL;
+      run = pushRun(gpu, i);
+      run->lo = lo;
+      run->hi = hi;
+      if (prev && runFits(prev, lo, hi) &&
+          (len == 0 || len >= 8 * prev->step)) {
+        run->origin = prev->origin;
+        run->step = prev->step;
+      } else {
+        placeRun(run);
+      }
+    }
+    if (len > 0) {
+      run->finest = lmin(run->finest, len);
+    }
+    run->count += n;
+  }
+  return dirty;
+}
+
+// Index of the run holding the vertex, runs must not be empty
+size_t findRun(const struct Gpu *gpu, size_t vertex) {
+  size_t lo = 0;
+  size_t hi = gpu->nrRuns;
+  while (hi - lo > 1) {
+    size_t mid = (lo + hi) / 2;
+    if (gpu->runs[mid].first <= vertex) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+int runVisible(const struct GpuRun *run, const sfFloatRect *area) {
+  return !area ||
+         (run->lo.x <= area->left + area->width && run->hi.x >= area->left &&
+          run->lo.y <= area->top + area->height && run->hi.y >= area->top);
+}
+
+// Whether anything in [first, end) may be visible in the area
+int rangeTouches(const struct Gpu *gpu, size_t first, size_t end,
+                 sfFloatRect area) {
+  if (first >= end || !gpu->nrRuns) {
+    return 0;
+  }
+  for (size_t r = findRun(gpu, first);
+       r < gpu->nrRuns && gpu->runs[r].first < end; ++r) {
+    if (runVisible(&gpu->runs[r], &area)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int uploadCompact(struct Gpu *gpu, const struct DrawVertex *vxa,
+                  const uint16_t *segColors, const struct Palette *palette,
+                  size_t dirty, size_t end) {
+  if (dirty >= end) {
+    return 1;
+  }
+
+  size_t r = findRun(gpu, dirty);
+  struct GpuVertex *staging = (struct GpuVertex *)gpu->staging;
+  gpu->gl.bindBuffer(GL_ARRAY_BUFFER, gpu->vbo);
+  for (size_t i = dirty; i < end;) {
+    size_t count = lmin(end - i, GPU_STAGING);
+    for (size_t k = 0; k < count; ++k) {
+      while (i + k >= gpu->runs[r].first + gpu->runs[r].count) {
+        ++r;
+      }
+      const struct GpuRun *run = &gpu->runs[r];
+      staging[k].x = (int16_t)lrintf((vxa[i + k].position.x - run->origin.x) /
+                                     run->step);
+      staging[k].y = (int16_t)lrintf((vxa[i + k].position.y - run->origin.y) /
+                                     run->step);
+      staging[k].color = segColors[(i + k) / 2];
+      if (staging[k].color >= gpu->nrColors) {
+        syncPalette(gpu, palette, staging[k].color);
+      }
+    }
+    gpu->gl.bufferSubData(GL_ARRAY_BUFFER, i * sizeof(struct GpuVertex),
+                          count * sizeof(struct GpuVertex), staging);
+    i += count;
+  }
+  gpu->gl.bindBuffer(GL_ARRAY_BUFFER, 0);
+  return 1;
+}
+
+int uploadPlain(struct Gpu *gpu, const struct DrawVertex *vxa,
+                const uint16_t *segColors, const struct Palette *palette,
+                size_t first, size_t count) {
+  sfVertex *staging = (sfVertex *)gpu->staging;
+  for (size_t i = 0; i < count; i += GPU_STAGING) {
+    size_t n = lmin(count - i, GPU_STAGING);
+    for (size_t k = 0; k < n; ++k) {
+      staging[k].position = vxa[first + i + k].position;
+      staging[k].color = palette->colors[segColors[(first + i + k) / 2]];
+      staging[k].texCoords = (sfVector2f){0, 0};
+    }
+    if (!sfVertexBuffer_update(gpu->vxb, staging, n, first + i)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Uploads the vertices [first, first + count) of vxa; everything uploaded
+// past them is discarded, just like the history is
+int uploadVertices(struct Gpu *gpu, const struct DrawVertex *vxa,
+                   const uint16_t *segColors, const struct Palette *palette,
+                   size_t first, size_t count) {
+  size_t dirty = layoutRuns(gpu, vxa, first, first + count);
+  if (dirty == SIZE_MAX) {
+    return 0;
+  }
+
+  if (gpu->compact) {
+    if (!uploadCompact(gpu, vxa, segColors, palette, dirty, first + count)) {
+      return 0;
+    }
+  } else if (!uploadPlain(gpu, vxa, segColors, palette, first, count)) {
+    return 0;
+  }
+  gpu->size = first + count;
+  return 1;
+}
+
+// Lays out the run r again from scratch, possibly as several runs; the runs
+// after it keep their grids. Returns the lowest vertex whose encoding
+// changed.
+size_t relayoutRun(struct Gpu *gpu, const struct DrawVertex *vxa, size_t r) {
+  size_t first = gpu->runs[r].first;
+  size_t end = first + gpu->runs[r].count;
+  size_t nrTail = gpu->nrRuns - r - 1;
+  struct GpuRun *tail = NULL;
+  if (nrTail) {
+    tail = (struct GpuRun *)malloc(nrTail * sizeof(struct GpuRun));
+    if (!tail) {
+      return SIZE_MAX;
+    }
+    memcpy(tail, gpu->runs + r + 1, nrTail * sizeof(struct GpuRun));
+  }
+
+  gpu->nrRuns = r;
+  size_t dirty = layoutRuns(gpu, vxa, first, end);
+  if (dirty != SIZE_MAX && nrTail) {
+    if (reserveRuns(gpu, nrTail)) {
+      memcpy(gpu->runs + gpu->nrRuns, tail, nrTail * sizeof(struct GpuRun));
+      gpu->nrRuns += nrTail;
+    } else {
+      dirty = SIZE_MAX;
+    }
+  }
+  free(tail);
+  return dirty;
+}
+
+// Uploads the vertices [first, first + count) of vxa again after they were
+// edited in place; unlike uploadVertices everything past them is kept. Runs
+// holding them get tight bounding boxes again, and the ones whose grid no
+// longer reaches their content are laid out anew on their own.
+int updateVertices(struct Gpu *gpu, const struct DrawVertex *vxa,
+                   const uint16_t *segColors, const struct Palette *palette,
+                   size_t first, size_t count) {
+  size_t end = lmin(first + count, gpu->size);
+  size_t dirty = first;
+  size_t dirtyEnd = end;
+  if (first >= end) {
+    return 1;
+  }
+
+  for (size_t r = findRun(gpu, first);
+       r < gpu->nrRuns && gpu->runs[r].first < end;) {
+    struct GpuRun *run = &gpu->runs[r];
+    size_t runEnd = run->first + run->count;
+    sfVector2f lo;
+    sfVector2f hi;
+    vxBounds(vxa + run->first, run->count, &lo, &hi);
+    if (!gpu->compact || runFits(run, lo, hi)) {
+      run->lo = lo;
+      run->hi = hi;
+      ++r;
+      continue;
+    }
+    size_t nrRuns = gpu->nrRuns;
+    size_t relaid = relayoutRun(gpu, vxa, r);
+    if (relaid == SIZE_MAX) {
+      return 0;
+    }
+    dirty = lmin(dirty, relaid);
+    dirtyEnd = lmax(dirtyEnd, runEnd);
+    r += gpu->nrRuns - nrRuns + 1;
+  }
+
+  if (gpu->compact) {
+    return uploadCompact(gpu, vxa, segColors, palette, dirty, dirtyEnd);
+  }
+  return uploadPlain(gpu, vxa, segColors, palette, first, end - first);
+}
+
+// Draws the vertices [first, first + count) onto either the window or the
+// texture, skipping the runs lying outside of the area when one is given
+void drawVertices(struct Gpu *gpu, sfRenderWindow *window,
+                  sfRenderTexture *texture, size_t first, size_t count,
+                  const sfFloatRect *area) {
+  size_t end = first + count;
+  if (!count || !gpu->nrRuns) {
+    return;
+  }
+
+  if (!gpu->compact) {
+    for (size_t r = findRun(gpu, first);
+         r < gpu->nrRuns && gpu->runs[r].first < end;) {
+      if (!runVisible(&gpu->runs[r], area)) {
+        ++r;
+        continue;
+      }
+      size_t from = lmax(gpu->runs[r].first, first);
+      size_t to = gpu->runs[r].first + gpu->runs[r].count;
+      while (++r < gpu->nrRuns && gpu->runs[r].first < end &&
+             runVisible(&gpu->runs[r], area)) {
+        to = gpu->runs[r].first + gpu->runs[r].count;
+      }
+      to = lmin(to, end);
+      if (window) {
+        sfRenderWindow_drawVertexBufferRange(window, gpu->vxb, from, to - from,
+                                             NULL);
+      } else {
+        sfRenderTexture_drawVertexBufferRange(texture, gpu->vxb, from,
+                                              to - from, NULL);
+      }
+    }
+    return;
+  }
+
+  const sfView *view;
+  sfIntRect vp;
+  sfVector2u targetSize;
+  if (window) {
+    sfRenderWindow_setActive(window, sfTrue);
+    view = sfRenderWindow_getView(window);
+    vp = sfRenderWindow_getViewport(window, view);
+    targetSize = sfRenderWindow_getSize(window);
+  } else {
+    sfRenderTexture_setActive(texture, sfTrue);
+    view = sfRenderTexture_getView(texture);
+    vp = sfRenderTexture_getViewport(texture, view);
+    targetSize = sfRenderTexture_getSize(texture);
+  }
+
+  sfTransform tr = sfView_getTransform(view);
+  const float *m = tr.matrix;
+  GLfloat transform[16] = {m[0], m[3], 0, m[6], m[1], m[4], 0, m[7],
+                           0,    0,    1, 0,    m[2], m[5], 0, m[8]};
+
+  glViewport(vp.left, targetSize.y - (vp.top + vp.height), vp.width,
+             vp.height);
+  glEnable(GL_BLEND);
+  gpu->gl.blendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE,
+                            GL_ONE_MINUS_SRC_ALPHA);
+  gpu->gl.useProgram(gpu->program);
+  gpu->gl.uniformMatrix4fv(gpu->transformLoc, 1, GL_FALSE, transform);
+  gpu->gl.uniform1i(gpu->paletteLoc, 0);
+  gpu->gl.activeTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, gpu->palette);
+  gpu->gl.bindBuffer(GL_ARRAY_BUFFER, gpu->vbo);
+  gpu->gl.enableVertexAttribArray(0);
+  gpu->gl.enableVertexAttribArray(1);
+  gpu->gl.vertexAttribPointer(0, 2, GL_SHORT, GL_FALSE,
+                              sizeof(struct GpuVertex),
+                              (const void *)offsetof(struct GpuVertex, x));
+  gpu->gl.vertexAttribPointer(1, 1, GL_UNSIGNED_SHORT, GL_FALSE,
+                              sizeof(struct GpuVertex),
+                              (const void *)offsetof(struct GpuVertex, color));
+
+  // neighbouring visible runs on the same grid go out in a single call
+  for (size_t r = findRun(gpu, first);
+       r < gpu->nrRuns && gpu->runs[r].first < end;) {
+    const struct GpuRun *run = &gpu->runs[r];
+    if (!runVisible(run, area)) {
+      ++r;
+      continue;
+    }
+    size_t from = lmax(run->first, first);
+    size_t to = run->first + run->count;
+    while (++r < gpu->nrRuns && gpu->runs[r].first < end &&
+           runVisible(&gpu->runs[r], area) &&
+           gpu->runs[r].step == run->step &&
+           gpu->runs[r].origin.x == run->origin.x &&
+           gpu->runs[r].origin.y == run->origin.y) {
+      to = gpu->runs[r].first + gpu->runs[r].count;
+    }
+    to = lmin(to, end);
+    gpu->gl.uniform2f(gpu->originLoc, run->origin.x, run->origin.y);
+    gpu->gl.uniform1f(gpu->stepLoc, run->step);
+    glDrawArrays(GL_LINES, from, to - from);
+  }
+
+  gpu->gl.disableVertexAttribArray(0);
+  gpu->gl.disableVertexAttribArray(1);
+  gpu->gl.bindBuffer(GL_ARRAY_BUFFER, 0);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  gpu->gl.useProgram(0);
+  if (window) {
+    sfRenderWindow_resetGLStates(window);
+  } else {
+    sfRenderTexture_resetGLStates(texture);
+  }
+}
+
+#define TILE_SIDE 512
+#define TILE_CACHE 96
+#define TILE_RENDERS_PER_FRAME 4
+#define TILE_MIN_VERTICES (1 << 16)
+
+// A raster of the settled drawing over one world tile at one zoom bucket
+struct Tile {
+  sfRenderTexture *rt;
+  long x;
+  long y;
+  int zoom;
+  int valid;
+  unsigned long used;
+};
+
+struct TileCache {
+  struct Tile tiles[TILE_CACHE];
+  size_t base; // every valid tile holds exactly the vertices [0, base)
+  unsigned long frame;
+  sfSprite *sprite;
+  sfView *view;
+};
+
+int createTileCache(struct TileCache *tc) {
+  memset(tc, 0, sizeof(*tc));
+  tc->sprite = sfSprite_create();
+  tc->view = sfView_create();
+  return tc->sprite && tc->view;
+}
+
+void destroyTileCache(struct TileCache *tc) {
+  for (size_t i = 0; i < TILE_CACHE; ++i) {
+    if (tc->tiles[i].rt) {
+      sfRenderTexture_destroy(tc->tiles[i].rt);
+    }
+  }
+  if (tc->sprite) {
+    sfSprite_destroy(tc->sprite);
+  }
+  if (tc->view) {
+    sfView_destroy(tc->view);
+  }
+  memset(tc, 0, sizeof(*tc));
+}
+
+sfFloatRect tileArea(const struct Tile *tile) {
+  float side = ldexpf(TILE_SIDE, tile->zoom);
+  sfFloatRect area = {tile->x * side, tile->y * side, side, side};
+  return area;
+}
+
+void drawIntoTile(struct TileCache *tc, struct Gpu *gpu, struct Tile *tile,
+                  size_t first, size_t count) {
+  sfFloatRect area = tileArea(tile);
+  sfView_reset(tc->view, area);
+  sfRenderTexture_setView(tile->rt, tc->view);
+  drawVertices(gpu, NULL, tile->rt, first, count, &area);
+  sfRenderTexture_display(tile->rt);
+}
+
+// Drops the tiles showing anything of the vertices [first, end)
+void invalidateTiles(struct TileCache *tc, const struct Gpu *gpu, size_t first,
+                     size_t end) {
+  end = lmin(end, tc->base);
+  if (first >= end) {
+    return;
+  }
+  for (size_t i = 0; i < TILE_CACHE; ++i) {
+    struct Tile *tile = &tc->tiles[i];
+    if (tile->valid && rangeTouches(gpu, first, end, tileArea(tile))) {
+      tile->valid = 0;
+    }
+  }
+}
+
+// Drops the tiles showing anything past n, to be called whenever the
+// history is scrubbed back or about to be overwritten
+void retractTiles(struct TileCache *tc, const struct Gpu *gpu, size_t n) {
+  if (n >= tc->base) {
+    return;
+  }
+  invalidateTiles(tc, gpu, n, tc->base);
+  tc->base = n;
+}
+
+// Brings the cached tiles up to the vertices [0, n); new geometry is drawn
+// on top of the existing rasters instead of re-rendering them
+void settleTiles(struct TileCache *tc, struct Gpu *gpu, size_t n) {
+  if (n < tc->base) {
+    retractTiles(tc, gpu, n);
+    return;
+  }
+  for (size_t i = 0; i < TILE_CACHE && n > tc->base; ++i) {
+    struct Tile *tile = &tc->tiles[i];
+    if (tile->valid && rangeTouches(gpu, tc->base, n, tileArea(tile))) {
+      drawIntoTile(tc, gpu, tile, tc->base, n - tc->base);
+    }
+  }
+  tc->base = n;
+}
+
+struct Tile *acquireTile(struct TileCache *tc, long x, long y, int zoom,
+                         int *renders) {
+  struct Tile *victim = NULL;
+  for (size_t i = 0; i < TILE_CACHE; ++i) {
+    struct Tile *tile = &tc->tiles[i];
+    if (tile->valid && tile->x == x && tile->y == y && tile->zoom == zoom) {
+      tile->used = tc->frame;
+      return tile;
+    }
+    // free slots first, then the least recently used tile
+    if (tile->used != tc->frame &&
+        (!victim || (victim->valid &&
+                     (!tile->valid || tile->used < victim->used)))) {
+      victim = tile;
+    }
+  }
+
+  if (!victim || *renders == 0) {
+    return NULL;
+  }
+  if (!victim->rt) {
+    sfContextSettings settings = {0, 0, 0, 1, 1, sfContextDefault, sfFalse};
+    victim->rt =
+        sfRenderTexture_createWithSettings(TILE_SIDE, TILE_SIDE, &settings);
+    if (!victim->rt) {
+      return NULL;
+    }
+    sfRenderTexture_setSmooth(victim->rt, sfTrue);
+  }
+  --*renders;
+
+  victim->x = x;
+  victim->y = y;
+  victim->zoom = zoom;
+  victim->valid = 1;
+  victim->used = tc->frame;
+  sfRenderTexture_clear(victim->rt, sfTransparent);
+  return victim;
+}
+
+// Limits drawing to the window pixels of the area, which must be upright on
+// screen
+void scissorArea(sfRenderWindow *window, const sfView *view,
+                 sfFloatRect area) {
+  sfVector2i a = sfRenderWindow_mapCoordsToPixel(
+      window, (sfVector2f){area.left, area.top}, view);
+  sfVector2i b = sfRenderWindow_mapCoordsToPixel(
+      window,
+      (sfVector2f){area.left + area.width, area.top + area.height}, view);
+  int height = (int)sfRenderWindow_getSize(window).y;
+  glScissor(lmin(a.x, b.x), height - lmax(a.y, b.y), abs(b.x - a.x),
+            abs(b.y - a.y));
+}
+
+// Composes the vertices [0, n) from cached tiles plus the geometry not
+// settled into them yet. Tiles still missing get the runs over them drawn
+// directly, clipped to them so that nothing is blended twice; returns 0
+// while any are missing.
+int drawCanvas(struct TileCache *tc, struct Gpu *gpu, sfRenderWindow *window,
+                size_t n) {
+  const sfView *view = sfRenderWindow_getView(window);
+  sfVector2f center = sfView_getCenter(view);
+  sfVector2f size = sfView_getSize(view);
+  float angle = sfView_getRotation(view) * 3.1415927f / 180;
+  float c = fabsf(cosf(angle));
+  float s = fabsf(sinf(angle));
+  sfFloatRect visible;
+  visible.width = c * size.x + s * size.y;
+  visible.height = s * size.x + c * size.y;
+  visible.left = center.x - visible.width / 2;
+  visible.top = center.y - visible.height / 2;
+
+  retractTiles(tc, gpu, n);
+
+  sfIntRect vp = sfRenderWindow_getViewport(window, view);
+  int zoom = (int)floorf(log2f(fabsf(size.x) / lmax(vp.width, 1)) + 0.5f);
+  float side = ldexpf(TILE_SIDE, zoom);
+  long x0 = (long)floorf(visible.left / side);
+  long y0 = (long)floorf(visible.top / side);
+  long x1 = (long)floorf((visible.left + visible.width) / side);
+  long y1 = (long)floorf((visible.top + visible.height) / side);
+
+  long nrTiles = (x1 - x0 + 1) * (y1 - y0 + 1);
+
+  if (tc->base < TILE_MIN_VERTICES || nrTiles > TILE_CACHE) {
+    drawVertices(gpu, window, NULL, 0, n, &visible);
+    return 1;
+  }
+
+  ++tc->frame;
+  int renders = TILE_RENDERS_PER_FRAME;
+  sfFloatRect missing[TILE_CACHE];
+  size_t nrMissing = 0;
+  for (long y = y0; y <= y1; ++y) {
+    for (long x = x0; x <= x1; ++x) {
+      int fresh = renders;
+      struct Tile *tile = acquireTile(tc, x, y, zoom, &renders);
+      if (!tile) {
+        sfFloatRect area = {x * side, y * side, side, side};
+        missing[nrMissing++] = area;
+      } else if (fresh != renders) {
+        drawIntoTile(tc, gpu, tile, 0, tc->base);
+      }
+    }
+  }
+
+  // a tilted tile cannot be scissored
+  if (nrMissing && fmodf(sfView_getRotation(view), 90) != 0) {
+    drawVertices(gpu, window, NULL, 0, n, &visible);
+    return 0;
+  }
+
+  sfVector2f scale = {side / TILE_SIDE, side / TILE_SIDE};
+  sfSprite_setScale(tc->sprite, scale);
+  for (size_t i = 0; i < TILE_CACHE; ++i) {
+    struct Tile *tile = &tc->tiles[i];
+    if (tile->valid && tile->used == tc->frame) {
+      sfFloatRect area = tileArea(tile);
+      sfSprite_setTexture(tc->sprite, sfRenderTexture_getTexture(tile->rt),
+                          sfTrue);
+      sfSprite_setPosition(tc->sprite, (sfVector2f){area.left, area.top});
+      sfRenderWindow_drawSprite(window, tc->sprite, NULL);
+    }
+  }
+  if (nrMissing) {
+    glEnable(GL_SCISSOR_TEST);
+    for (size_t i = 0; i < nrMissing; ++i) {
+      scissorArea(window, view, missing[i]);
+      drawVertices(gpu, window, NULL, 0, tc->base, &missing[i]);
+    }
+    glDisable(GL_SCISSOR_TEST);
+  }
+  drawVertices(gpu, window, NULL, tc->base, n - tc->base, &visible);
+  return !nrMissing;
+}
+
+#define RING_SIZE (1 << 14)
+
+enum CommandType {
+  CMD_VERTICES,
+  CMD_EDIT,
+  CMD_HISTORY,
+  CMD_VIEW,
+  CMD_CROSS,
+  CMD_OVERLAY
+};
+
+// A change captured by the event thread for the render thread
+struct Command {
+  enum CommandType type;
+  size_t first; // CMD_VERTICES, CMD_EDIT: the vertices
+  size_t count; // [first, first + count) of vxa; CMD_HISTORY: the number
+                // of vertices to draw
+  int flag;     // CMD_HISTORY: nothing is in progress, CMD_CROSS and
+                // CMD_OVERLAY: shown
+  sfVector2f center; // CMD_VIEW, CMD_OVERLAY: the rectangle around it
+  sfVector2f size;
+  float rotation;
+};
+
+// Single-producer single-consumer queue from the event thread to the render
+// thread; head only advances once a command has been applied
+struct Ring {
+  struct Command slots[RING_SIZE];
+  _Alignas(64) atomic_size_t head;
+  _Alignas(64) atomic_size_t tail;
+};
+
+int ringPush(struct Ring *ring, const struct Command *cmd) {
+  size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+  if (tail - head == RING_SIZE) {
+    return 0;
+  }
+  ring->slots[tail % RING_SIZE] = *cmd;
+  atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+  return 1;
+}
+
+const struct Command *ringPeek(struct Ring *ring) {
+  size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+  return head == tail ? NULL : &ring->slots[head % RING_SIZE];
+}
+
+void ringPop(struct Ring *ring) {
+  size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+int ringEmpty(struct Ring *ring) {
+  return atomic_load_explicit(&ring->head, memory_order_acquire) ==
+         atomic_load_explicit(&ring->tail, memory_order_acquire);
+}
+
+struct Renderer {
+  struct Ring ring;
+  sfRenderWindow *window;
+  const struct DrawVertex *vxa;  // only read below what was sent or loaded
+  const uint16_t *segColors;     // likewise
+  const struct Palette *palette; // only the colours behind those indices
+  struct Loader *loader;         // NULL unless a drawing is being loaded
+  size_t capacity;
+  atomic_int quit;
+  atomic_int failed;
+};
+
+// Blocks only when the render thread is a whole ring behind
+int sendCommand(struct Renderer *rd, const struct Command *cmd) {
+  while (!ringPush(&rd->ring, cmd)) {
+    if (atomic_load(&rd->failed)) {
+      return 0;
+    }
+    sfSleep(sfMicroseconds(200));
+  }
+  return 1;
+}
+
+int sendRange(struct Renderer *rd, enum CommandType type, size_t first,
+              size_t count) {
+  struct Command cmd;
+  memset(&cmd, 0, sizeof(cmd));
+  cmd.type = type;
+  cmd.first = first;
+  cmd.count = count;
+  return sendCommand(rd, &cmd);
+}
+
+int sendVertices(struct Renderer *rd, size_t first, size_t count) {
+  return sendRange(rd, CMD_VERTICES, first, count);
+}
+
+// Lets the render thread finish reading vxa before the history gets
+// overwritten or anything sent is edited in place
+void waitRenderer(struct Renderer *rd) {
+  while (!ringEmpty(&rd->ring) && !atomic_load(&rd->failed)) {
+    sfSleep(sfMicroseconds(200));
+  }
+}
+
+// Owns every OpenGL resource; the event thread only talks to it through
+// the ring so that input is sampled regardless of the frame cost
+void renderLoop(void *userData) {
+  struct Renderer *rd = (struct Renderer *)userData;
+  const size_t uploadChunk = 1 << 16;
+  const sfInt64 uploadBudget = 4000; // microseconds per frame
+  const sfInt64 maxNap = 8000;       // microseconds between idle polls
+  struct Gpu gpu;
+  struct TileCache tiles;
+  sfView *view = NULL;
+  sfClock *uploadClock = NULL;
+  sfVertex centerVxs[4];
+  sfVertex overlayVxs[8];
+  sfColor tmpCol = {160, 160, 160, 160};
+  sfVector2u winsize = sfRenderWindow_getSize(rd->window);
+  size_t nrVcs2draw = 0;
+  size_t resident = 0;
+  size_t rangeDone = 0; // of the CMD_EDIT at the head
+  int loading = rd->loader != NULL;
+  int idle = 1;
+  int drawCross = 0;
+  int drawOverlay = 0;
+  int pendingTiles = 1;
+  sfInt64 nap = 1000;
+
+  memset(&gpu, 0, sizeof(gpu));
+  memset(&tiles, 0, sizeof(tiles));
+  sfRenderWindow_setActive(rd->window, sfTrue);
+
+  if (!createGpu(&gpu, rd->capacity) || !createTileCache(&tiles)) {
+    atomic_store(&rd->failed, 1);
+  }
+  view = sfView_copy(sfRenderWindow_getDefaultView(rd->window));
+  uploadClock = sfClock_create();
+  if (!view || !uploadClock) {
+    atomic_store(&rd->failed, 1);
+  }
+
+  memset(centerVxs, 0, sizeof(centerVxs));
+  memset(overlayVxs, 0, sizeof(overlayVxs));
+  for (size_t i = 0; i < 8; ++i) {
+    overlayVxs[i].color = tmpCol;
+  }
+  centerVxs[0].color = tmpCol;
+  centerVxs[1].color = tmpCol;
+  centerVxs[2].color = tmpCol;
+  centerVxs[3].color = tmpCol;
+
+  sfVector2f tmpVec;
+  tmpVec.x = winsize.x / 2 - 10;
+  tmpVec.y = winsize.y / 2;
+  centerVxs[0].position = tmpVec;
+  tmpVec.x = winsize.x / 2 + 10;
+  tmpVec.y = winsize.y / 2;
+  centerVxs[1].position = tmpVec;
+  tmpVec.x = winsize.x / 2;
+  tmpVec.y = winsize.y / 2 - 10;
+  centerVxs[2].position = tmpVec;
+  tmpVec.x = winsize.x / 2;
+  tmpVec.y = winsize.y / 2 + 10;
+  centerVxs[3].position = tmpVec;
+
+  while (!atomic_load(&rd->quit) && !atomic_load(&rd->failed)) {
+    int changed = 0;
+    const struct Command *cmd;
+
+    while ((cmd = ringPeek(&rd->ring))) {
+      if (loading && cmd->type != CMD_VIEW && cmd->type != CMD_CROSS &&
+          cmd->type != CMD_OVERLAY) {
+        // these are only sent once the loader is done; the whole drawing
+        // keeps streaming in, anything else needs the rest uploaded now
+        sfMutex_lock(rd->loader->mutex);
+        size_t nrParsed = rd->loader->nrParsed;
+        sfMutex_unlock(rd->loader->mutex);
+        if (cmd->type == CMD_HISTORY && cmd->count == nrParsed) {
+          idle = cmd->flag;
+          ringPop(&rd->ring);
+          changed = 1;
+          continue;
+        }
+        if (!uploadVertices(&gpu, rd->vxa, rd->segColors, rd->palette,
+                            resident, nrParsed - resident)) {
+          atomic_store(&rd->failed, 1);
+          break;
+        }
+        resident = nrVcs2draw = nrParsed;
+        loading = 0;
+      }
+
+      int unfinished = 0;
+      switch (cmd->type) {
+      case CMD_VERTICES:
+        retractTiles(&tiles, &gpu, cmd->first);
+        if (!uploadVertices(&gpu, rd->vxa, rd->segColors, rd->palette,
+                            cmd->first, cmd->count)) {
+          atomic_store(&rd->failed, 1);
+        }
+        break;
+      case CMD_EDIT: {
+        // a budgeted slice per frame, just like while loading; the command
+        // stays in the ring, holding back the ones after it, until done
+        size_t end = cmd->first + cmd->count;
+        size_t i = cmd->first + rangeDone;
+        sfClock_restart(uploadClock);
+        do {
+          size_t count = lmin(end - i, uploadChunk);
+          // before and after, the edited geometry may have moved elsewhere
+          invalidateTiles(&tiles, &gpu, i, i + count);
+          int ok = updateVertices(&gpu, rd->vxa, rd->segColors, rd->palette,
+                                  i, count);
+          invalidateTiles(&tiles, &gpu, i, i + count);
+          if (!ok) {
+            atomic_store(&rd->failed, 1);
+            break;
+          }
+          i += count;
+        } while (i < end &&
+                 sfClock_getElapsedTime(uploadClock).microseconds <
+                     uploadBudget);
+        rangeDone = i - cmd->first;
+        unfinished = i < end;
+        break;
+      }
+      case CMD_HISTORY:
+        nrVcs2draw = cmd->count;
+        idle = cmd->flag;
+        break;
+      case CMD_VIEW:
+        sfView_setCenter(view, cmd->center);
+        sfView_setSize(view, cmd->size);
+        sfView_setRotation(view, cmd->rotation);
+        sfRenderWindow_setView(rd->window, view);
+        break;
+      case CMD_CROSS:
+        drawCross = cmd->flag;
+        break;
+      case CMD_OVERLAY: {
+        sfVector2f lo = {cmd->center.x - cmd->size.x / 2,
+                         cmd->center.y - cmd->size.y / 2};
+        sfVector2f hi = {cmd->center.x + cmd->size.x / 2,
+                         cmd->center.y + cmd->size.y / 2};
+        sfVector2f corners[4] = {lo, {hi.x, lo.y}, hi, {lo.x, hi.y}};
+        for (size_t k = 0; k < 4; ++k) {
+          overlayVxs[k * 2].position = corners[k];
+          overlayVxs[k * 2 + 1].position = corners[(k + 1) % 4];
+        }
+        drawOverlay = cmd->flag;
+        break;
+      }
+      }
+      changed = 1;
+      if (unfinished) {
+        break;
+      }
+      rangeDone = 0;
+      ringPop(&rd->ring);
+    }
+
+    if (loading) {
+      sfMutex_lock(rd->loader->mutex);
+      size_t nrParsed = rd->loader->nrParsed;
+      int parsed = rd->loader->done;
+      sfMutex_unlock(rd->loader->mutex);
+
+      sfClock_restart(uploadClock);
+      while (resident < nrParsed &&
+             sfClock_getElapsedTime(uploadClock).microseconds <
+                 uploadBudget) {
+        size_t count = lmin(nrParsed - resident, uploadChunk);
+        if (!uploadVertices(&gpu, rd->vxa, rd->segColors, rd->palette,
+                            resident, count)) {
+          atomic_store(&rd->failed, 1);
+          break;
+        }
+        resident += count;
+      }
+      nrVcs2draw = resident;
+
+      if (parsed && resident == nrParsed) {
+        loading = 0;
+      }
+      changed = 1;
+    }
+
+    // polls back off while nothing happens, the first command after a
+    // pause waits half a frame at most
+    if (!changed && !pendingTiles) {
+      sfSleep(sfMicroseconds(nap));
+      nap = lmin(nap * 2, maxNap);
+      continue;
+    }
+    nap = 1000;
+
+    if (idle) {
+      settleTiles(&tiles, &gpu, nrVcs2draw);
+    }
+
+    sfRenderWindow_clear(rd->window, (sfColor){18, 20, 31, 255});
+    pendingTiles = !drawCanvas(&tiles, &gpu, rd->window, nrVcs2draw);
+
+    if (drawOverlay) {
+      sfRenderWindow_drawPrimitives(rd->window, overlayVxs, 8, sfLines, NULL);
+    }
+
+    if (drawCross) {
+      sfRenderWindow_setView(rd->window,
+                             sfRenderWindow_getDefaultView(rd->window));
+      sfRenderWindow_drawPrimitives(rd->window, centerVxs, 4, sfLines, NULL);
+      sfRenderWindow_setView(rd->window, view);
+    }
+    sfRenderWindow_display(rd->window);
+  }
+
+  destroyTileCache(&tiles);
+  destroyGpu(&gpu);
+  if (view) {
+    sfView_destroy(view);
+  }
+  if (uploadClock) {
+    sfClock_destroy(uploadClock);
+  }
+  sfRenderWindow_setActive(rd->window, sfFalse);
+}
+
+struct UndoNode {
+  struct UndoNode *prev;
+  size_t data;
+};
+
+void freeUndos(struct UndoNode *tail) {
+  while (tail) {
+    struct UndoNode *prev = tail->prev;
+    free(tail);
+    tail = prev;
+  }
+}
+
+#define INDEX_LEAF 32 // segments under a box of the lowest level
+#define INDEX_FANOUT 16
+#define INDEX_LEVELS 6
+#define INDEX_BUDGET (1 << 20) // vertices indexed per event loop iteration
+#define COMPACT_SLICE (1 << 17) // vertices moved per compaction step
+#define ERASER_RADIUS 8         // pixels
+
+// Erased segments keep their place, drawn in the transparent colour at the
+// start of the palette, until the drawing gets compacted; only the dead flag
+// of their stroke tells them apart
+static const uint16_t tombstone = 0;
+
+struct Box {
+  sfVector2f lo;
+  sfVector2f hi;
+};
+
+static const struct Box emptyBox = {{INFINITY, INFINITY},
+                                    {-INFINITY, -INFINITY}};
+
+// A stroke goes from its first vertex up to the first one of the next
+struct Stroke {
+  size_t first;
+  int dead;
+  int selected;
+};
+
+// A live stroke moved down over the erased vertices before it
+struct Move {
+  size_t stroke;
+  size_t from;
+  size_t to;
+  size_t count;
+};
+
+// What the eraser and the selection work on: the strokes of the drawing and
+// a hierarchy of bounding boxes over its segments in history order. Strokes
+// are drawn in one place, so whole subtrees get skipped by a hit test.
+struct Editor {
+  struct Stroke *strokes;
+  size_t nrStrokes;
+  size_t capStrokes;
+  struct Box *boxes[INDEX_LEVELS]; // level l has a box per
+  size_t capBoxes[INDEX_LEVELS];   // INDEX_LEAF * INDEX_FANOUT^l segments
+  size_t nrIndexed;                // vertices covered, always even
+  size_t nrLoaded; // vertices from the file, they carry no stroke boundaries
+  size_t *selection; // strokes
+  size_t nrSelected;
+  size_t capSelection;
+  struct Box selBox;
+  size_t nrDead;      // vertices of dead strokes
+  size_t compactFrom; // no dead stroke starts before it
+  struct Move *moves; // of the last compaction step
+  size_t nrMoves;
+  size_t capMoves;
+  size_t editFirst; // CMD_EDIT range not sent yet
+  size_t editEnd;
+};
+
+void destroyEditor(struct Editor *ed) {
+  free(ed->strokes);
+  for (int l = 0; l < INDEX_LEVELS; ++l) {
+    free(ed->boxes[l]);
+  }
+  free(ed->selection);
+  free(ed->moves);
+}
+
+void growBox(struct Box *box, struct Box by) {
+  box->lo.x = lmin(box->lo.x, by.lo.x);
+  box->lo.y = lmin(box->lo.y, by.lo.y);
+  box->hi.x = lmax(box->hi.x, by.hi.x);
+  box->hi.y = lmax(box->hi.y, by.hi.y);
+}
+
+int boxesMeet(struct Box a, struct Box b) {
+  return a.lo.x <= b.hi.x && b.lo.x <= a.hi.x && a.lo.y <= b.hi.y &&
+         b.lo.y <= a.hi.y;
+}
+
+int boxHolds(struct Box box, sfVector2f p) {
+  return box.lo.x <= p.x && p.x <= box.hi.x && box.lo.y <= p.y &&
+         p.y <= box.hi.y;
+}
+
+struct Box cornersBox(sfVector2f a, sfVector2f b) {
+  struct Box box = {{lmin(a.x, b.x), lmin(a.y, b.y)},
+                    {lmax(a.x, b.x), lmax(a.y, b.y)}};
+  return box;
+}
+
+struct Box segmentBox(const struct DrawVertex *vxa, size_t seg) {
+  return cornersBox(vxa[seg * 2].position, vxa[seg * 2 + 1].position);
+}
+
+size_t indexSpan(int level) {
+  size_t span = INDEX_LEAF;
+  while (level--) {
+    span *= INDEX_FANOUT;
+  }
+  return span;
+}
+
+// Grows the boxes over a segment appended to the index
+int indexSegment(struct Editor *ed, size_t seg, struct Box box) {
+  for (int l = 0; l < INDEX_LEVELS; ++l) {
+    size_t span = indexSpan(l);
+    size_t b = seg / span;
+    if (b >= ed->capBoxes[l]) {
+      size_t cap = ed->capBoxes[l] ? ed->capBoxes[l] * 2 : 64;
+      struct Box *boxes =
+          (struct Box *)realloc(ed->boxes[l], cap * sizeof(struct Box));
+      if (!boxes) {
+        fprintf(stderr, "Failed to allocate memory (line %d)\n", __LINE__);
+        return 0;
+      }
+      ed->boxes[l] = boxes;
+      ed->capBoxes[l] = cap;
+    }
+    if (seg % span == 0) {
+      ed->boxes[l][b] = emptyBox;
+    }
+    growBox(&ed->boxes[l][b], box);
+  }
+  return 1;
+}
+
+// Recomputes box b of the level from what lies below it, among the first
+// nrSegs segments
+void fitBox(struct Editor *ed, const struct DrawVertex *vxa, int level,
+            size_t b, size_t nrSegs) {
+  size_t span = indexSpan(level);
+  struct Box box = emptyBox;
+  if (level == 0) {
+    size_t end = lmin((b + 1) * span, nrSegs);
+    for (size_t seg = b * span; seg < end; ++seg) {
+      growBox(&box, segmentBox(vxa, seg));
+    }
+  } else {
+    size_t childSpan = span / INDEX_FANOUT;
+    for (size_t c = b * INDEX_FANOUT;
+         c < (b + 1) * INDEX_FANOUT && c * childSpan < nrSegs; ++c) {
+      growBox(&box, ed->boxes[level - 1][c]);
+    }
+  }
+  ed->boxes[level][b] = box;
+}
+
+// Shrinks the boxes down to the first n vertices, the last ones partially
+// covered get recomputed from below
+void truncateIndex(struct Editor *ed, const struct DrawVertex *vxa,
+                   size_t n) {
+  size_t nrSegs = n / 2;
+  for (int l = 0; l < INDEX_LEVELS; ++l) {
+    if (nrSegs % indexSpan(l)) {
+      fitBox(ed, vxa, l, nrSegs / indexSpan(l), nrSegs);
+    }
+  }
+  ed->nrIndexed = nrSegs * 2;
+}
+
+// Recomputes the boxes over the segments [first, end) and their ancestors
+// after those segments moved, so that the old place stops being covered
+void refitIndex(struct Editor *ed, const struct DrawVertex *vxa, size_t first,
+                size_t end) {
+  size_t nrSegs = ed->nrIndexed / 2;
+  end = lmin(end, nrSegs);
+  if (first >= end) {
+    return;
+  }
+  for (int l = 0; l < INDEX_LEVELS; ++l) {
+    size_t span = indexSpan(l);
+    for (size_t b = first / span; b * span < end; ++b) {
+      fitBox(ed, vxa, l, b, nrSegs);
+    }
+  }
+}
+
+// Index of the stroke holding the vertex, there must be strokes
+size_t strokeAt(const struct Editor *ed, size_t vertex) {
+  size_t lo = 0;
+  size_t hi = ed->nrStrokes;
+  while (hi - lo > 1) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (ed->strokes[mid].first <= vertex) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+size_t strokeEnd(const struct Editor *ed, size_t k) {
+  return k + 1 < ed->nrStrokes ? ed->strokes[k + 1].first : ed->nrIndexed;
+}
+
+void clearSelection(struct Editor *ed) {
+  for (size_t s = 0; s < ed->nrSelected; ++s) {
+    ed->strokes[ed->selection[s]].selected = 0;
+  }
+  ed->nrSelected = 0;
+  ed->selBox = emptyBox;
+}
+
+int pushStroke(struct Editor *ed, size_t first) {
+  if (ed->nrStrokes == ed->capStrokes) {
+    size_t cap = ed->capStrokes ? ed->capStrokes * 2 : 1024;
+    struct Stroke *strokes =
+        (struct Stroke *)realloc(ed->strokes, cap * sizeof(struct Stroke));
+    if (!strokes) {
+      fprintf(stderr, "Failed to allocate memory (line %d)\n", __LINE__);
+      return 0;
+    }
+    ed->strokes = strokes;
+    ed->capStrokes = cap;
+  }
+  struct Stroke *stroke = &ed->strokes[ed->nrStrokes++];
+  memset(stroke, 0, sizeof(*stroke));
+  stroke->first = first;
+  return 1;
+}
+
+// Covers the vertices up to n. Loaded ones get split into strokes wherever
+// a segment does not continue the previous one.
+int indexVertices(struct Editor *ed, const struct DrawVertex *vxa,
+                  const uint16_t *segColors, size_t n) {
+  for (size_t i = ed->nrIndexed; i + 2 <= n; i += 2) {
+    int continues = ed->nrStrokes && i > 0 &&
+                    vxa[i].position.x == vxa[i - 1].position.x &&
+                    vxa[i].position.y == vxa[i - 1].position.y &&
+                    segColors[i / 2] == segColors[i / 2 - 1];
+    if (!ed->nrStrokes || (i < ed->nrLoaded && !continues)) {
+      if (!pushStroke(ed, i)) {
+        return 0;
+      }
+    }
+    if (!indexSegment(ed, i / 2, segmentBox(vxa, i / 2))) {
+      return 0;
+    }
+    ed->nrIndexed = i + 2;
+  }
+  return 1;
+}
+
+// Starts a stroke at the vertex first, forgetting everything past it
+int beginStroke(struct Editor *ed, const struct DrawVertex *vxa,
+                const uint16_t *segColors, size_t first) {
+  if (!indexVertices(ed, vxa, segColors, first)) {
+    return 0;
+  }
+  clearSelection(ed);
+  size_t end = ed->nrIndexed;
+  while (ed->nrStrokes) {
+    struct Stroke *last = &ed->strokes[ed->nrStrokes - 1];
+    if (last->dead) {
+      ed->nrDead -= end - lmax(last->first, first);
+    }
+    if (last->first < first) {
+      break;
+    }
+    end = last->first;
+    --ed->nrStrokes;
+  }
+  ed->nrLoaded = lmin(ed->nrLoaded, first);
+  truncateIndex(ed, vxa, first);
+  return pushStroke(ed, first);
+}
+
+// Merges edits of neighbouring vertices into one CMD_EDIT
+void flushEdits(struct Editor *ed, struct Renderer *rd) {
+  if (ed->editEnd > ed->editFirst) {
+    sendRange(rd, CMD_EDIT, ed->editFirst, ed->editEnd - ed->editFirst);
+  }
+  ed->editFirst = ed->editEnd = 0;
+}
+
+void noteEdit(struct Editor *ed, struct Renderer *rd, size_t first,
+              size_t end) {
+  if (ed->editEnd > ed->editFirst && ed->editEnd == first) {
+    ed->editEnd = end;
+    return;
+  }
+  flushEdits(ed, rd);
+  ed->editFirst = first;
+  ed->editEnd = end;
+}
+
+void killStroke(struct Editor *ed, uint16_t *segColors, struct Renderer *rd,
+                size_t k) {
+  struct Stroke *stroke = &ed->strokes[k];
+  size_t end = strokeEnd(ed, k);
+  if (stroke->dead) {
+    return;
+  }
+  for (size_t seg = stroke->first / 2; seg < end / 2; ++seg) {
+    segColors[seg] = tombstone;
+  }
+  stroke->dead = 1;
+  stroke->selected = 0;
+  ed->nrDead += end - stroke->first;
+  ed->compactFrom = lmin(ed->compactFrom, stroke->first);
+  noteEdit(ed, rd, stroke->first, end);
+}
+
+void queryBoxes(const struct Editor *ed, const struct DrawVertex *vxa,
+                int level, size_t b, size_t nrSegs, struct Box area,
+                void (*visit)(void *, size_t), void *userData) {
+  if (!boxesMeet(ed->boxes[level][b], area)) {
+    return;
+  }
+  size_t span = indexSpan(level);
+  if (level == 0) {
+    size_t end = lmin((b + 1) * span, nrSegs);
+    size_t k = strokeAt(ed, b * span * 2);
+    for (size_t seg = b * span; seg < end; ++seg) {
+      while (k + 1 < ed->nrStrokes && ed->strokes[k + 1].first <= seg * 2) {
+        ++k;
+      }
+      if (!ed->strokes[k].dead && boxesMeet(segmentBox(vxa, seg), area)) {
+        visit(userData, seg);
+      }
+    }
+    return;
+  }
+  size_t childSpan = span / INDEX_FANOUT;
+  for (size_t c = b * INDEX_FANOUT;
+       c < (b + 1) * INDEX_FANOUT && c * childSpan < nrSegs; ++c) {
+    queryBoxes(ed, vxa, level - 1, c, nrSegs, area, visit, userData);
+  }
+}
+
+// Calls visit for each live segment among the first nrSegs whose bounding
+// box meets the area; visit may erase strokes on the way
+void queryIndex(const struct Editor *ed, const struct DrawVertex *vxa,
+                size_t nrSegs, struct Box area,
+                void (*visit)(void *, size_t), void *userData) {
+  size_t span = indexSpan(INDEX_LEVELS - 1);
+  nrSegs = lmin(nrSegs, ed->nrIndexed / 2);
+  for (size_t b = 0; b * span < nrSegs; ++b) {
+    queryBoxes(ed, vxa, INDEX_LEVELS - 1, b, nrSegs, area, visit, userData);
+  }
+}
+
+float pointSegment2(sfVector2f p, sfVector2f a, sfVector2f b) {
+  float dx = b.x - a.x;
+  float dy = b.y - a.y;
+  float len2 = dx * dx + dy * dy;
+  float t = len2 > 0 ? ((p.x - a.x) * dx + (p.y - a.y) * dy) / len2 : 0;
+  t = lmax(0.f, lmin(1.f, t));
+  float ex = a.x + t * dx - p.x;
+  float ey = a.y + t * dy - p.y;
+  return ex * ex + ey * ey;
+}
+
+float turn(sfVector2f o, sfVector2f a, sfVector2f b) {
+  return (a.x - o.x) * (b.y - o.y) - (a.y - o.y) * (b.x - o.x);
+}
 
-    for (size_t i = 0; i < sz; ++i) {
-      union FloatUintConversion xconv;
-      union FloatUintConversion yconv;
-      xconv.fl = vertices[i].position.x;
-      yconv.fl = vertices[i].position.y;
-      fprintf(f, "%u %u %u\n", xconv.ui, yconv.ui,
-              sfColor_toInteger(vertices[i].color));
-    }
+int segmentsCross(sfVector2f a, sfVector2f b, sfVector2f c, sfVector2f d) {
+  return (turn(c, d, a) > 0) != (turn(c, d, b) > 0) &&
+         (turn(a, b, c) > 0) != (turn(a, b, d) > 0);
+}
 
-    fclose(f);
-    free(filename);
-    break;
+float segmentsDistance2(sfVector2f a, sfVector2f b, sfVector2f c,
+                        sfVector2f d) {
+  if (segmentsCross(a, b, c, d)) {
+    return 0;
   }
-  return 1;
+  return lmin(lmin(pointSegment2(a, c, d), pointSegment2(b, c, d)),
+              lmin(pointSegment2(c, a, b), pointSegment2(d, a, b)));
+}
+
+int segmentInBox(sfVector2f a, sfVector2f b, struct Box box) {
+  sfVector2f corners[4] = {
+      box.lo, {box.hi.x, box.lo.y}, box.hi, {box.lo.x, box.hi.y}};
+  if (boxHolds(box, a) || boxHolds(box, b)) {
+    return 1;
+  }
+  for (size_t k = 0; k < 4; ++k) {
+    if (segmentsCross(a, b, corners[k], corners[(k + 1) % 4])) {
+      return 1;
+    }
+  }
+  return 0;
 }
 
-int exportSvg(const sfVertex *vertices, size_t sz) {
-  sfVector2f leftTop = vertices[0].position;
-  sfVector2f rightBottom = vertices[0].position;
+struct Erasing {
+  struct Editor *ed;
+  const struct DrawVertex *vxa;
+  uint16_t *segColors;
+  struct Renderer *rd;
+  sfVector2f from;
+  sfVector2f to;
+  float radius;
+  int waited;
+};
 
-  for (size_t i = 0; i < sz; ++i) {
-    leftTop.x = lmin(leftTop.x, vertices[i].position.x);
-    leftTop.y = lmin(leftTop.y, vertices[i].position.y);
-    rightBottom.x = lmax(rightBottom.x, vertices[i].position.x);
-    rightBottom.y = lmax(rightBottom.y, vertices[i].position.y);
+void eraseSegment(void *userData, size_t seg) {
+  struct Erasing *er = (struct Erasing *)userData;
+  const struct DrawVertex *vxs = er->vxa + seg * 2;
+  if (segmentsDistance2(er->from, er->to, vxs[0].position, vxs[1].position) >
+      er->radius * er->radius) {
+    return;
   }
+  if (!er->waited) {
+    waitRenderer(er->rd);
+    er->waited = 1;
+  }
+  killStroke(er->ed, er->segColors, er->rd, strokeAt(er->ed, seg * 2));
+}
 
-  sfVector2u winSize = {rightBottom.x - leftTop.x + 1,
-                        rightBottom.y - leftTop.y + 1};
+// Erases the strokes among the first nrDrawn vertices coming within radius
+// of the eraser moving from one point to the other
+void eraseAlong(struct Editor *ed, const struct DrawVertex *vxa,
+                uint16_t *segColors, struct Renderer *rd, size_t nrDrawn,
+                sfVector2f from, sfVector2f to, float radius) {
+  struct Erasing er = {ed, vxa, segColors, rd, from, to, radius, 0};
+  struct Box area = cornersBox(from, to);
+  area.lo.x -= radius;
+  area.lo.y -= radius;
+  area.hi.x += radius;
+  area.hi.y += radius;
+  queryIndex(ed, vxa, nrDrawn / 2, area, eraseSegment, &er);
+  flushEdits(ed, rd);
+}
 
-  for (;;) {
-    unsigned long long nanoseconds;
-    struct timespec ts;
-    int ret_code = clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
-    if (ret_code == -1) {
-      fprintf(stderr, "Failed to obtain timestamp. errno = %i: %s\n", errno,
-              strerror(errno));
-      nanoseconds = UINT64_MAX;
-      return 0;
-    } else {
-      nanoseconds = SEC_TO_NS((unsigned long long)ts.tv_sec) +
-                    (unsigned long long)ts.tv_nsec;
-    }
+struct Selecting {
+  struct Editor *ed;
+  const struct DrawVertex *vxa;
+  struct Box area;
+  int failed;
+};
 
-    char *filename = (char *)malloc(50);
-    if (!filename) {
+void selectSegment(void *userData, size_t seg) {
+  struct Selecting *sel = (struct Selecting *)userData;
+  struct Editor *ed = sel->ed;
+  const struct DrawVertex *vxs = sel->vxa + seg * 2;
+  if (!segmentInBox(vxs[0].position, vxs[1].position, sel->area)) {
+    return;
+  }
+  size_t k = strokeAt(ed, seg * 2);
+  if (ed->strokes[k].selected || sel->failed) {
+    return;
+  }
+  if (ed->nrSelected == ed->capSelection) {
+    size_t cap = ed->capSelection ? ed->capSelection * 2 : 256;
+    size_t *selection =
+        (size_t *)realloc(ed->selection, cap * sizeof(size_t));
+    if (!selection) {
       fprintf(stderr, "Failed to allocate memory (line %d)\n", __LINE__);
-      return 0;
+      sel->failed = 1;
+      return;
     }
+    ed->selection = selection;
+    ed->capSelection = cap;
+  }
+  ed->selection[ed->nrSelected++] = k;
+  ed->strokes[k].selected = 1;
+
+  struct Box bounds;
+  size_t first = ed->strokes[k].first;
+  vxBounds(sel->vxa + first, strokeEnd(ed, k) - first, &bounds.lo,
+           &bounds.hi);
+  growBox(&ed->selBox, bounds);
+}
 
-    sprintf(filename, "%llu.html", nanoseconds);
-    if (access(filename, F_OK) == 0) {
-      free(filename);
-      continue;
-    }
+// Selects the strokes among the first nrDrawn vertices that pass through
+// the area, instead of the ones selected so far
+int selectStrokes(struct Editor *ed, const struct DrawVertex *vxa,
+                  size_t nrDrawn, struct Box area) {
+  struct Selecting sel = {ed, vxa, area, 0};
+  clearSelection(ed);
+  queryIndex(ed, vxa, nrDrawn / 2, area, selectSegment, &sel);
+  return !sel.failed;
+}
 
-    FILE *f = fopen(filename, "w");
-    if (!f) {
-      fprintf(stderr, "Failed to open the file %s\n", filename);
-      free(filename);
-      return 0;
+struct Box movedBox(struct Box box, sfVector2f delta) {
+  box.lo.x += delta.x;
+  box.lo.y += delta.y;
+  box.hi.x += delta.x;
+  box.hi.y += delta.y;
+  return box;
+}
+
+void moveSelection(struct Editor *ed, struct DrawVertex *vxa,
+                   struct Renderer *rd, sfVector2f delta) {
+  sfVector2f origin = {-delta.x, -delta.y};
+  if (!ed->nrSelected) {
+    return;
+  }
+  waitRenderer(rd);
+  // the render thread reads whole runs around each edit sent, so nothing
+  // goes up before every stroke is in its new place
+  for (size_t s = 0; s < ed->nrSelected; ++s) {
+    size_t k = ed->selection[s];
+    size_t first = ed->strokes[k].first;
+    size_t end = strokeEnd(ed, k);
+    vxTransform(vxa + first, end - first, origin, 1, vxa + first);
+    refitIndex(ed, vxa, first / 2, end / 2);
+  }
+  for (size_t s = 0; s < ed->nrSelected; ++s) {
+    size_t k = ed->selection[s];
+    noteEdit(ed, rd, ed->strokes[k].first, strokeEnd(ed, k));
+  }
+  flushEdits(ed, rd);
+  ed->selBox = movedBox(ed->selBox, delta);
+}
+
+void recolourSelection(struct Editor *ed, uint16_t *segColors,
+                       struct Renderer *rd, uint16_t color) {
+  if (!ed->nrSelected) {
+    return;
+  }
+  waitRenderer(rd);
+  for (size_t s = 0; s < ed->nrSelected; ++s) {
+    size_t k = ed->selection[s];
+    size_t end = strokeEnd(ed, k);
+    for (size_t seg = ed->strokes[k].first / 2; seg < end / 2; ++seg) {
+      segColors[seg] = color;
     }
+    noteEdit(ed, rd, ed->strokes[k].first, end);
+  }
+  flushEdits(ed, rd);
+}
 
-    fprintf(f,
-            "<!DOCTYPE html>\n<html>\n<body "
-            "style=\"background-color:#000000;\">\n<h1>svg</h1>\n"
-            "<svg width=\"%d\" height=\"%d\">\n",
-            winSize.x, winSize.y);
+void deleteSelection(struct Editor *ed, uint16_t *segColors,
+                     struct Renderer *rd) {
+  if (!ed->nrSelected) {
+    return;
+  }
+  waitRenderer(rd);
+  for (size_t s = 0; s < ed->nrSelected; ++s) {
+    killStroke(ed, segColors, rd, ed->selection[s]);
+  }
+  flushEdits(ed, rd);
+  clearSelection(ed);
+}
 
-    for (size_t i = 0; i < sz; i += 2) {
+int sendOverlay(struct Renderer *rd, struct Box box, int shown) {
+  struct Command cmd;
+  memset(&cmd, 0, sizeof(cmd));
+  cmd.type = CMD_OVERLAY;
+  cmd.flag = shown;
+  if (shown) {
+    cmd.center.x = (box.lo.x + box.hi.x) / 2;
+    cmd.center.y = (box.lo.y + box.hi.y) / 2;
+    cmd.size.x = box.hi.x - box.lo.x;
+    cmd.size.y = box.hi.y - box.lo.y;
+  }
+  return sendCommand(rd, &cmd);
+}
 
-      sfVector2f tr_coords_0 = {vertices[i].position.x - leftTop.x,
-                                vertices[i].position.y - leftTop.y};
+void dropSelection(struct Editor *ed, struct Renderer *rd) {
+  clearSelection(ed);
+  sendOverlay(rd, ed->selBox, 0);
+}
 
-      sfVector2f tr_coords_1 = {vertices[i + 1].position.x - leftTop.x,
-                                vertices[i + 1].position.y - leftTop.y};
+// ERASER_RADIUS in drawing units
+float eraserRadius(const sfView *view, sfVector2u winsize) {
+  return ERASER_RADIUS * fabsf(sfView_getSize(view).x) / winsize.x;
+}
 
-      fprintf(
-          f,
-          "<line x1=\"%f\" y1=\"%f\" x2=\"%f"
-          "\" y2=\"%f\" style=\"stroke:rgba(%d,%d,%d,%d);stroke-width:1\" />\n",
-          tr_coords_0.x, tr_coords_0.y, tr_coords_1.x, tr_coords_1.y,
-          (int)vertices[i].color.r, (int)vertices[i].color.g,
-          (int)vertices[i].color.b, (int)vertices[i].color.a);
+int pushMove(struct Editor *ed, size_t stroke, size_t from, size_t to,
+             size_t count) {
+  if (ed->nrMoves == ed->capMoves) {
+    size_t cap = ed->capMoves ? ed->capMoves * 2 : 1024;
+    struct Move *moves =
+        (struct Move *)realloc(ed->moves, cap * sizeof(struct Move));
+    if (!moves) {
+      fprintf(stderr, "Failed to allocate memory (line %d)\n", __LINE__);
+      return 0;
     }
+    ed->moves = moves;
+    ed->capMoves = cap;
+  }
+  struct Move *move = &ed->moves[ed->nrMoves++];
+  move->stroke = stroke;
+  move->from = from;
+  move->to = to;
+  move->count = count;
+  return 1;
+}
 
-    fprintf(f, "</svg>\n</body>\n</html>");
+// Where the vertex position p ends up after the moves packed the live
+// strokes of [first, end) from first on; past end everything comes down by
+// shift, the erased vertices cut off at the end of the drawing
+size_t movedPosition(const struct Editor *ed, size_t first, size_t end,
+                     size_t shift, size_t p) {
+  if (p <= first) {
+    return p;
+  }
+  if (p >= end) {
+    return p - shift;
+  }
+  size_t lo = 0;
+  size_t hi = ed->nrMoves;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (ed->moves[mid].from <= p) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (!lo) {
+    return first;
+  }
+  const struct Move *move = &ed->moves[lo - 1];
+  return move->to + lmin(p - move->from, move->count);
+}
 
-    fclose(f);
-    free(filename);
-    break;
+// Index of the move of stroke k, nrMoves if it did not move
+size_t findMove(const struct Editor *ed, size_t k) {
+  size_t lo = 0;
+  size_t hi = ed->nrMoves;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (ed->moves[mid].stroke < k) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
   }
-  return 1;
+  return lo < ed->nrMoves && ed->moves[lo].stroke == k ? lo : ed->nrMoves;
 }
 
-int save_to(const char *filename, const sfVertex *vertices, size_t sz,
-            sfVector2u winSize) {
-  FILE *f = fopen(filename, "w");
-  if (!f) {
-    fprintf(stderr, "Failed to open the file %s\n", filename);
+// One step of dropping the erased strokes for good: the first gap of dead
+// vertices trades places with the live strokes after it, about budget
+// vertices of them, and gets cut off once it reaches the end of the
+// drawing. The history position and undo steps move along. Each step
+// leaves a whole drawing behind, so events get handled in between; rd is
+// NULL once the render thread is gone.
+int compactSlice(struct Editor *ed, struct DrawVertex *vxa,
+                 uint16_t *segColors, struct Renderer *rd, size_t *nrVcs,
+                 size_t *nrVcs2draw, size_t *lastUpdatedNrVcs2draw,
+                 struct UndoNode **undos, size_t budget) {
+  if (!ed->nrDead) {
+    return 1;
+  }
+  if (!indexVertices(ed, vxa, segColors, *nrVcs)) {
     return 0;
   }
+  size_t k0 = strokeAt(ed, lmin(ed->compactFrom, ed->nrIndexed - 1));
+  while (k0 < ed->nrStrokes && !ed->strokes[k0].dead) {
+    ++k0;
+  }
+  if (k0 == ed->nrStrokes) {
+    return 1;
+  }
 
-  for (size_t i = 0; i < sz; ++i) {
-    union FloatUintConversion xconv;
-    union FloatUintConversion yconv;
-    xconv.fl = vertices[i].position.x;
-    yconv.fl = vertices[i].position.y;
-    fprintf(f, "%d %d %d\n", xconv.ui, yconv.ui,
-            sfColor_toInteger(vertices[i].color));
+  // The render thread only gets the new history position after the
+  // moved vertices, so no undone stroke may come down below the drawn one
+  // on the way. A stroke across it still goes, alone, or nothing could
+  // ever pass it.
+  size_t first = ed->strokes[k0].first;
+  size_t drawn = rd && first < *nrVcs2draw ? *nrVcs2draw : SIZE_MAX;
+  size_t write = first;
+  size_t end = first;
+  size_t k = k0;
+  ed->nrMoves = 0;
+  for (; k < ed->nrStrokes; ++k) {
+    size_t from = ed->strokes[k].first;
+    size_t next = strokeEnd(ed, k);
+    if (!ed->strokes[k].dead) {
+      if (ed->nrMoves &&
+          (next > drawn || next - ed->moves[0].from > budget)) {
+        break;
+      }
+      if (from >= drawn) {
+        // only erased vertices lie past the gap, nothing to see moves
+        *nrVcs2draw = first;
+        return 1;
+      }
+      if (!pushMove(ed, k, from, write, next - from)) {
+        return 0;
+      }
+      write += next - from;
+      if (next > drawn) {
+        end = next;
+        ++k;
+        break;
+      }
+    }
+    end = next;
   }
+  int truncated = k == ed->nrStrokes;
+  size_t shift = truncated ? end - write : 0;
 
-  fclose(f);
+  if (rd) {
+    waitRenderer(rd);
+  }
+  for (size_t m = 0; m < ed->nrMoves; ++m) {
+    const struct Move *move = &ed->moves[m];
+    memmove(vxa + move->to, vxa + move->from,
+            move->count * sizeof(struct DrawVertex));
+    memmove(segColors + move->to / 2, segColors + move->from / 2,
+            move->count / 2 * sizeof(uint16_t));
+  }
+  if (truncated) {
+    memmove(vxa + write, vxa + end,
+            (*nrVcs - end) * sizeof(struct DrawVertex));
+    memmove(segColors + write / 2, segColors + end / 2,
+            (*nrVcs - end + 1) / 2 * sizeof(uint16_t));
+    *nrVcs -= shift;
+  } else {
+    for (size_t m = 0; m < ed->nrMoves; ++m) {
+      const struct Move *move = &ed->moves[m];
+      for (size_t seg = lmax(move->from, write) / 2;
+           seg < (move->from + move->count) / 2; ++seg) {
+        segColors[seg] = tombstone;
+      }
+    }
+  }
+
+  // undo steps are relative, they get walked down from the newest position
+  size_t top = *lastUpdatedNrVcs2draw;
+  struct UndoNode **node = undos;
+  while (*node && top > first) {
+    size_t bottom = (*node)->data <= top ? top - (*node)->data : 0;
+    size_t data = movedPosition(ed, first, end, shift, top) -
+                  movedPosition(ed, first, end, shift, bottom);
+    top = bottom;
+    if (!data) {
+      struct UndoNode *node2delete = *node;
+      *node = node2delete->prev;
+      free(node2delete);
+      continue;
+    }
+    (*node)->data = data;
+    node = &(*node)->prev;
+  }
+  *lastUpdatedNrVcs2draw =
+      movedPosition(ed, first, end, shift, *lastUpdatedNrVcs2draw);
+  *nrVcs2draw = movedPosition(ed, first, end, shift, *nrVcs2draw);
+
+  // the moved strokes, then the gap as one dead stroke unless cut off
+  size_t kept = k0 + ed->nrMoves + !truncated;
+  for (size_t m = 0; m < ed->nrMoves; ++m) {
+    struct Stroke stroke = ed->strokes[ed->moves[m].stroke];
+    stroke.first = ed->moves[m].to;
+    ed->strokes[k0 + m] = stroke;
+  }
+  if (!truncated) {
+    struct Stroke *gap = &ed->strokes[k0 + ed->nrMoves];
+    memset(gap, 0, sizeof(*gap));
+    gap->first = write;
+    gap->dead = 1;
+    memmove(ed->strokes + kept, ed->strokes + k,
+            (ed->nrStrokes - k) * sizeof(struct Stroke));
+  }
+  ed->nrStrokes -= k - kept;
+
+  size_t nrSelected = 0;
+  for (size_t s = 0; s < ed->nrSelected; ++s) {
+    size_t sk = ed->selection[s];
+    if (sk >= k) {
+      sk -= k - kept;
+    } else if (sk >= k0) {
+      size_t m = findMove(ed, sk);
+      if (m == ed->nrMoves) {
+        continue;
+      }
+      sk = k0 + m;
+    }
+    ed->selection[nrSelected++] = sk;
+  }
+  ed->nrSelected = nrSelected;
+
+  if (truncated) {
+    ed->nrDead -= shift;
+    ed->nrLoaded = lmin(ed->nrLoaded, write);
+    truncateIndex(ed, vxa, write);
+  }
+  refitIndex(ed, vxa, first / 2, write / 2);
+  ed->compactFrom = write;
+
+  if (!rd) {
+    return 1;
+  }
+  if (truncated) {
+    return sendVertices(rd, first, *nrVcs - first);
+  }
+  // the vertices left behind by the moves turn into erased ones
+  const struct Move *last = &ed->moves[ed->nrMoves - 1];
+  noteEdit(ed, rd, first, write);
+  noteEdit(ed, rd, lmax(write, ed->moves[0].from), last->from + last->count);
+  flushEdits(ed, rd);
   return 1;
 }
 
-struct UndoNode {
-  struct UndoNode *prev;
-  size_t data;
-};
+// Compacts once an eighth of the drawing is erased
+int compactionDue(const struct Editor *ed, size_t nrVcs) {
+  return ed->nrDead && ed->nrDead >= nrVcs / 8;
+}
 
-void freeUndos(struct UndoNode *tail) {
-  while (tail) {
-    struct UndoNode *prev = tail->prev;
-    free(tail);
-    tail = prev;
-  }
+// Whether the index lags behind or the drawing waits for compaction, work
+// done between events
+int editorPending(const struct Editor *ed, size_t nrVcs) {
+  return ed->nrIndexed / 2 < nrVcs / 2 || compactionDue(ed, nrVcs);
 }
 
 struct Garbage {
@@ -225,44 +2765,83 @@ struct Garbage {
   sfClock *zoomClock;
   sfClock *rotateClock;
   sfCursor *crossyCursor;
-  sfVertexBuffer *vxb;
-  sfVertex *vxa;
+  sfView *view;
+  struct DrawVertex *vxa;
+  uint16_t *segColors; // palette indices, one per pair of vertices of vxa
+  struct Palette palette;
+  struct Loader *loader;
+  sfThread *loaderThread;
+  struct Renderer *renderer;
+  sfThread *renderThread;
+  struct Editor editor;
+  sfClock *idleClock;
 };
 
 void cleanGarbage(struct Garbage g) {
+  if (g.renderThread) {
+    atomic_store(&g.renderer->quit, 1);
+    sfThread_destroy(g.renderThread);
+  }
+  free(g.renderer);
+  if (g.loaderThread) {
+    sfMutex_lock(g.loader->mutex);
+    g.loader->stop = 1;
+    sfMutex_unlock(g.loader->mutex);
+    sfThread_destroy(g.loaderThread);
+  }
+  if (g.loader) {
+    if (g.loader->fin) {
+      fclose(g.loader->fin);
+    }
+    sfMutex_destroy(g.loader->mutex);
+    free(g.loader);
+  }
   free(g.vxa);
-  sfVertexBuffer_destroy(g.vxb);
+  free(g.segColors);
+  destroyPalette(&g.palette);
+  if (g.view) {
+    sfView_destroy(g.view);
+  }
   sfRenderWindow_destroy(g.window);
   sfCursor_destroy(g.crossyCursor);
   sfClock_destroy(g.unredoClock);
   sfClock_destroy(g.rotateClock);
   sfClock_destroy(g.zoomClock);
+  sfClock_destroy(g.idleClock);
   freeUndos(g.undos);
+  destroyEditor(&g.editor);
 }
 
 int main(int argc, char **argv) {
   sfVector2u winsize = {1000, 1000};
   const size_t nrMaxVecs = 100000000;
-  int preloaded = 0;
+  int loading = 0;
   size_t nrVcs = 0;
   size_t nrVcs2draw = 0;
 
   sfColor color = sfWhite;
+  uint16_t ink = 0; // palette index of color, taken as a stroke begins
   int ruler = 0;
   int circle = 0;
+  int eraser = 0;
+  int selector = 0;
+  // writing the drawing waits for the erased strokes to be compacted away
+  int saveDue = 0;
+  int svgDue = 0;
+  int canvasDue = 0;
 
   size_t lastUpdatedNrVcs2draw = 0;
-
-  sfVertex centerVxs[4];
-  sfColor tmpCol = {160, 160, 160, 160};
+  size_t sentNrVcs2draw = 0;
+  int sentIdle = 1;
 
   sfContextSettings settings = {0, 0, 16, 1, 1, sfContextDefault, sfFalse};
 
   struct Garbage g;
   memset(&g, 0, sizeof(g));
 
-  g.vxa = (sfVertex *)malloc(nrMaxVecs * sizeof(sfVertex));
-  if (!g.vxa) {
+  g.vxa = (struct DrawVertex *)malloc(nrMaxVecs * sizeof(struct DrawVertex));
+  g.segColors = (uint16_t *)malloc((nrMaxVecs + 1) / 2 * sizeof(uint16_t));
+  if (!g.vxa || !g.segColors || !createPalette(&g.palette)) {
     cleanGarbage(g);
     return EXIT_FAILURE;
   }
@@ -270,23 +2849,29 @@ int main(int argc, char **argv) {
   if (argc > 3) {
     FILE *fin = fopen(argv[3], "r");
     if (fin) {
-      sfVector2f pos_in;
-      sfUint32 color_in;
-      union FloatUintConversion xconv, yconv;
-      while (1) {
-        if (3 != fscanf(fin, "%d %d %d\n", &xconv.ui, &yconv.ui, &color_in)) {
-          break;
-        } else {
-          pos_in.x = xconv.fl;
-          pos_in.y = yconv.fl;
-          sfVertex tmpVx = {pos_in, sfColor_fromInteger(color_in)};
-          g.vxa[nrVcs] = tmpVx;
-          ++nrVcs;
-        }
+      g.loader = (struct Loader *)calloc(1, sizeof(struct Loader));
+      if (!g.loader) {
+        fclose(fin);
+        cleanGarbage(g);
+        return EXIT_FAILURE;
+      }
+      g.loader->fin = fin;
+      g.loader->vertices = g.vxa;
+      g.loader->segColors = g.segColors;
+      g.loader->palette = &g.palette;
+      g.loader->capacity = nrMaxVecs;
+      g.loader->mutex = sfMutex_create();
+      if (!g.loader->mutex) {
+        cleanGarbage(g);
+        return EXIT_FAILURE;
+      }
+      g.loaderThread = sfThread_create(loadVertices, g.loader);
+      if (!g.loaderThread) {
+        cleanGarbage(g);
+        return EXIT_FAILURE;
       }
-      nrVcs2draw = nrVcs;
-      preloaded = 1;
-      fclose(fin);
+      sfThread_launch(g.loaderThread);
+      loading = 1;
     } else {
       fprintf(stderr, "Failed to load\n");
       cleanGarbage(g);
@@ -328,39 +2913,44 @@ int main(int argc, char **argv) {
 
   sfRenderWindow_setMouseCursor(g.window, g.crossyCursor);
 
-  g.vxb = sfVertexBuffer_create(nrMaxVecs, sfLines, sfVertexBufferStream);
+  g.view = sfView_copy(sfRenderWindow_getDefaultView(g.window));
+  // malloc does not honour the cache line alignment of the ring indices
+  g.renderer = (struct Renderer *)aligned_alloc(
+      64, (sizeof(struct Renderer) + 63) / 64 * 64);
 
-  if (!g.vxb) {
+  if (!g.view || !g.renderer) {
     cleanGarbage(g);
     return EXIT_FAILURE;
   }
 
-  if (preloaded && !sfVertexBuffer_update(g.vxb, g.vxa, nrVcs, 0)) {
+  atomic_init(&g.renderer->ring.head, 0);
+  atomic_init(&g.renderer->ring.tail, 0);
+  atomic_init(&g.renderer->quit, 0);
+  atomic_init(&g.renderer->failed, 0);
+  g.renderer->window = g.window;
+  g.renderer->vxa = g.vxa;
+  g.renderer->segColors = g.segColors;
+  g.renderer->palette = &g.palette;
+  g.renderer->loader = g.loader;
+  g.renderer->capacity = nrMaxVecs;
+
+  // the context moves over to the render thread
+  sfRenderWindow_setActive(g.window, sfFalse);
+  g.renderThread = sfThread_create(renderLoop, g.renderer);
+
+  if (!g.renderThread) {
     cleanGarbage(g);
     return EXIT_FAILURE;
   }
 
-  centerVxs[0].color = tmpCol;
-  centerVxs[1].color = tmpCol;
-  centerVxs[2].color = tmpCol;
-  centerVxs[3].color = tmpCol;
-
-  sfVector2f tmpVec;
-  tmpVec.x = winsize.x / 2 - 10;
-  tmpVec.y = winsize.y / 2;
-  centerVxs[0].position = tmpVec;
-  tmpVec.x = winsize.x / 2 + 10;
-  tmpVec.y = winsize.y / 2;
-  centerVxs[1].position = tmpVec;
-  tmpVec.x = winsize.x / 2;
-  tmpVec.y = winsize.y / 2 - 10;
-  centerVxs[2].position = tmpVec;
-  tmpVec.x = winsize.x / 2;
-  tmpVec.y = winsize.y / 2 + 10;
-  centerVxs[3].position = tmpVec;
+  sfThread_launch(g.renderThread);
 
   sfVector2i oldMousePos;
+  sfVector2f anchorGl = {0, 0}; // last eraser point, selection drag start
   int drawing = 0;
+  int erasing = 0;
+  int selecting = 0;
+  int movingSelection = 0;
   int nrVcsIncr = 0;
   int nrVcsDecr = 0;
   int nrVcsFineIncr = 0;
@@ -372,13 +2962,15 @@ int main(int argc, char **argv) {
   int waitEvt = 1;
 
   int viewMoving = 0;
+  int viewChanged = 0;
   int drawCross = 0;
 
   g.unredoClock = sfClock_create();
   g.zoomClock = sfClock_create();
   g.rotateClock = sfClock_create();
+  g.idleClock = sfClock_create();
 
-  if (!g.unredoClock || !g.zoomClock || !g.rotateClock) {
+  if (!g.unredoClock || !g.zoomClock || !g.rotateClock || !g.idleClock) {
     cleanGarbage(g);
     return EXIT_FAILURE;
   }
@@ -388,61 +2980,86 @@ int main(int argc, char **argv) {
   while (sfRenderWindow_isOpen(g.window)) {
     sfEvent evt;
     int enough2wait = 0;
+    int pending = loading || editorPending(&g.editor, nrVcs) || saveDue ||
+                  svgDue || canvasDue;
     while (!enough2wait &&
-           whateverEvent(waitEvt, g.window, &evt, &enough2wait)) {
+           whateverEvent(waitEvt && !pending, g.window, &evt, &enough2wait)) {
+      sfClock_restart(g.idleClock);
       switch (evt.type) {
-      case sfEvtMouseWheelScrolled: {
-        sfView *view = sfView_copy(sfRenderWindow_getView(g.window));
-        if (!view) {
-          cleanGarbage(g);
-          return EXIT_FAILURE;
-        }
-        sfView_zoom(view, exp(evt.mouseWheelScroll.delta / 3.f));
-        sfRenderWindow_setView(g.window, view);
-        sfView_destroy(view);
+      case sfEvtMouseWheelScrolled:
+        sfView_zoom(g.view, exp(evt.mouseWheelScroll.delta / 3.f));
+        viewChanged = 1;
         break;
-      }
       case sfEvtMouseMoved: {
         sfVector2i mousePos = {evt.mouseMove.x, evt.mouseMove.y};
         sfVector2f oldMousePosGl = sfRenderWindow_mapPixelToCoords(
-            g.window, oldMousePos, sfRenderWindow_getView(g.window));
+            g.window, oldMousePos, g.view);
         sfVector2f mousePosGl = sfRenderWindow_mapPixelToCoords(
-            g.window, mousePos, sfRenderWindow_getView(g.window));
+            g.window, mousePos, g.view);
         if (viewMoving) {
-          sfView *view = sfView_copy(sfRenderWindow_getView(g.window));
-          if (!view) {
-            cleanGarbage(g);
-            return EXIT_FAILURE;
-          }
           sfVector2f tmpDelta;
           tmpDelta.x = oldMousePosGl.x - mousePosGl.x;
           tmpDelta.y = oldMousePosGl.y - mousePosGl.y;
-          sfView_move(view, tmpDelta);
-          sfRenderWindow_setView(g.window, view);
+          sfView_move(g.view, tmpDelta);
+          viewChanged = 1;
           oldMousePos = mousePos;
-          sfView_destroy(view);
         } else if (!ruler && !circle && drawing && nrVcs2draw < nrMaxVecs - 2) {
-          sfVertex vcs[2];
-          vcs[0].position = oldMousePosGl;
-          vcs[1].position = mousePosGl;
-          vcs[0].color = vcs[1].color = color;
-          if (sfVertexBuffer_update(g.vxb, vcs, 2, nrVcs)) {
-            g.vxa[nrVcs + 0] = vcs[0];
-            g.vxa[nrVcs + 1] = vcs[1];
-            nrVcs += 2;
-            nrVcs2draw += 2;
-            oldMousePos = mousePos;
-          }
+          g.vxa[nrVcs + 0].position = oldMousePosGl;
+          g.vxa[nrVcs + 1].position = mousePosGl;
+          g.segColors[nrVcs / 2] = ink;
+          sendVertices(g.renderer, nrVcs, 2);
+          nrVcs += 2;
+          nrVcs2draw += 2;
+          oldMousePos = mousePos;
+        } else if (erasing) {
+          eraseAlong(&g.editor, g.vxa, g.segColors, g.renderer, nrVcs2draw,
+                     anchorGl, mousePosGl, eraserRadius(g.view, winsize));
+          anchorGl = mousePosGl;
+        } else if (selecting) {
+          sendOverlay(g.renderer, cornersBox(anchorGl, mousePosGl), 1);
+        } else if (movingSelection) {
+          sfVector2f delta = {mousePosGl.x - anchorGl.x,
+                              mousePosGl.y - anchorGl.y};
+          sendOverlay(g.renderer, movedBox(g.editor.selBox, delta), 1);
         }
         break;
       }
       case sfEvtMouseButtonPressed:
-        if ((evt.mouseButton.button == sfMouseLeft) &&
+        if ((evt.mouseButton.button == sfMouseLeft) && (eraser || selector) &&
+            !loading && !nrVcsDecr && !nrVcsIncr && !nrVcsFineDecr &&
+            !nrVcsFineIncr && !zoomDecr && !zoomIncr && !rotateLeft &&
+            !rotateRight) {
+          sfVector2i mousePos = {evt.mouseButton.x, evt.mouseButton.y};
+          anchorGl =
+              sfRenderWindow_mapPixelToCoords(g.window, mousePos, g.view);
+          if (!indexVertices(&g.editor, g.vxa, g.segColors, nrVcs)) {
+            cleanGarbage(g);
+            return EXIT_FAILURE;
+          }
+          if (eraser) {
+            erasing = 1;
+            eraseAlong(&g.editor, g.vxa, g.segColors, g.renderer, nrVcs2draw,
+                       anchorGl, anchorGl, eraserRadius(g.view, winsize));
+          } else if (boxHolds(g.editor.selBox, anchorGl)) {
+            movingSelection = 1;
+          } else {
+            selecting = 1;
+          }
+        } else if ((evt.mouseButton.button == sfMouseLeft) &&
+                   !loading &&
             ((nrVcs2draw < nrMaxVecs - 2 && !circle) ||
              (nrVcs2draw < nrMaxVecs - crcsz && circle)) &&
             !nrVcsDecr && !nrVcsIncr && !nrVcsFineDecr && !nrVcsFineIncr &&
             !zoomDecr && !zoomIncr && !rotateLeft && !rotateRight) {
+          if (nrVcs2draw < nrVcs) {
+            waitRenderer(g.renderer);
+          }
           nrVcs = nrVcs2draw;
+          if (!beginStroke(&g.editor, g.vxa, g.segColors, nrVcs)) {
+            cleanGarbage(g);
+            return EXIT_FAILURE;
+          }
+          ink = paletteIndex(&g.palette, color);
           drawing = 1;
         } else if (evt.mouseButton.button == sfMouseMiddle) {
           viewMoving = 1;
@@ -455,20 +3072,16 @@ int main(int argc, char **argv) {
           drawing = 0;
           sfVector2i mousePos = {evt.mouseButton.x, evt.mouseButton.y};
           sfVector2f oldMousePosGl = sfRenderWindow_mapPixelToCoords(
-              g.window, oldMousePos, sfRenderWindow_getView(g.window));
+              g.window, oldMousePos, g.view);
           sfVector2f mousePosGl = sfRenderWindow_mapPixelToCoords(
-              g.window, mousePos, sfRenderWindow_getView(g.window));
+              g.window, mousePos, g.view);
           if (!circle) {
-            sfVertex vcs[2];
-            vcs[0].position = oldMousePosGl;
-            vcs[1].position = mousePosGl;
-            vcs[0].color = vcs[1].color = color;
-            if (sfVertexBuffer_update(g.vxb, vcs, 2, nrVcs)) {
-              g.vxa[nrVcs + 0] = vcs[0];
-              g.vxa[nrVcs + 1] = vcs[1];
-              nrVcs += 2;
-              nrVcs2draw += 2;
-            }
+            g.vxa[nrVcs + 0].position = oldMousePosGl;
+            g.vxa[nrVcs + 1].position = mousePosGl;
+            g.segColors[nrVcs / 2] = ink;
+            sendVertices(g.renderer, nrVcs, 2);
+            nrVcs += 2;
+            nrVcs2draw += 2;
 
             if (nrVcs2draw > lastUpdatedNrVcs2draw) {
               struct UndoNode *newNode = malloc(sizeof(struct UndoNode));
@@ -483,9 +3096,9 @@ int main(int argc, char **argv) {
             }
 
           } else {
-            sfVertex circleVcs[crcsz];
-            for (size_t i = 0; i < crcsz; ++i) {
-              circleVcs[i].color = color;
+            struct DrawVertex *circleVcs = g.vxa + nrVcs;
+            for (size_t i = 0; i < crcsz / 2; ++i) {
+              g.segColors[nrVcs / 2 + i] = ink;
             }
             float distance = hypot(mousePosGl.x - oldMousePosGl.x,
                                    mousePosGl.y - oldMousePosGl.y);
@@ -503,13 +3116,9 @@ int main(int argc, char **argv) {
                   oldMousePosGl.y + distance * sin(((i + 1) * 4 * pi / crcsz));
             }
 
-            if (sfVertexBuffer_update(g.vxb, circleVcs, crcsz, nrVcs)) {
-              for (size_t i = 0; i < crcsz; ++i) {
-                g.vxa[nrVcs + i] = circleVcs[i];
-              }
-              nrVcs += crcsz;
-              nrVcs2draw += crcsz;
-            }
+            sendVertices(g.renderer, nrVcs, crcsz);
+            nrVcs += crcsz;
+            nrVcs2draw += crcsz;
 
             if (nrVcs2draw > lastUpdatedNrVcs2draw) {
               struct UndoNode *newNode = malloc(sizeof(struct UndoNode));
@@ -524,17 +3133,47 @@ int main(int argc, char **argv) {
             }
           }
           waitEvt = 1;
+        } else if ((evt.mouseButton.button == sfMouseLeft) && erasing) {
+          erasing = 0;
+        } else if ((evt.mouseButton.button == sfMouseLeft) &&
+                   (selecting || movingSelection)) {
+          sfVector2i mousePos = {evt.mouseButton.x, evt.mouseButton.y};
+          sfVector2f mousePosGl = sfRenderWindow_mapPixelToCoords(
+              g.window, mousePos, g.view);
+          if (selecting &&
+              !selectStrokes(&g.editor, g.vxa, nrVcs2draw,
+                             cornersBox(anchorGl, mousePosGl))) {
+            cleanGarbage(g);
+            return EXIT_FAILURE;
+          } else if (movingSelection) {
+            sfVector2f delta = {mousePosGl.x - anchorGl.x,
+                                mousePosGl.y - anchorGl.y};
+            moveSelection(&g.editor, g.vxa, g.renderer, delta);
+          }
+          selecting = movingSelection = 0;
+          sendOverlay(g.renderer, g.editor.selBox, g.editor.nrSelected > 0);
         } else if (evt.mouseButton.button == sfMouseMiddle) {
           viewMoving = 0;
         }
         break;
       case sfEvtClosed: {
+        atomic_store(&g.renderer->quit, 1);
+        sfThread_wait(g.renderThread);
         sfRenderWindow_close(g.window);
 
+        if (loading) {
+          // never overwrite the source file with a partially loaded drawing
+          sfThread_wait(g.loaderThread);
+          nrVcs = g.loader->nrParsed;
+        }
+        // the render thread is gone, nothing needs to go up again
+        compactSlice(&g.editor, g.vxa, g.segColors, NULL, &nrVcs,
+                     &nrVcs2draw, &lastUpdatedNrVcs2draw, &g.undos, SIZE_MAX);
+
         if (argc > 3) {
-          save_to(argv[3], g.vxa, nrVcs, winsize);
+          save_to(argv[3], g.vxa, g.segColors, &g.palette, nrVcs, winsize);
         } else {
-          save(g.vxa, nrVcs, winsize);
+          save(g.vxa, g.segColors, &g.palette, nrVcs, winsize);
         }
         break;
       }
@@ -549,28 +3188,30 @@ int main(int argc, char **argv) {
         zoomIncr = 0;
         rotateLeft = 0;
         rotateRight = 0;
+        erasing = 0;
+        if (selecting || movingSelection) {
+          selecting = movingSelection = 0;
+          sendOverlay(g.renderer, g.editor.selBox, g.editor.nrSelected > 0);
+        }
         if (drawing) {
           drawing = 0;
           sfVector2i mousePos = {evt.mouseButton.x, evt.mouseButton.y};
           sfVector2f oldMousePosGl = sfRenderWindow_mapPixelToCoords(
-              g.window, oldMousePos, sfRenderWindow_getView(g.window));
+              g.window, oldMousePos, g.view);
           sfVector2f mousePosGl = sfRenderWindow_mapPixelToCoords(
-              g.window, mousePos, sfRenderWindow_getView(g.window));
-
-          sfVertex vcs[2];
-          vcs[0].position = oldMousePosGl;
-          vcs[1].position = mousePosGl;
-          vcs[0].color = vcs[1].color = color;
-          if (sfVertexBuffer_update(g.vxb, vcs, 2, nrVcs)) {
-            g.vxa[nrVcs + 0] = vcs[0];
-            g.vxa[nrVcs + 1] = vcs[1];
-            nrVcs += 2;
-            nrVcs2draw += 2;
-          }
+              g.window, mousePos, g.view);
+
+          g.vxa[nrVcs + 0].position = oldMousePosGl;
+          g.vxa[nrVcs + 1].position = mousePosGl;
+          g.segColors[nrVcs / 2] = ink;
+          sendVertices(g.renderer, nrVcs, 2);
+          nrVcs += 2;
+          nrVcs2draw += 2;
         }
         break;
       case sfEvtKeyPressed:
-        if (!drawing) {
+        if (!drawing && !erasing && !selecting && !movingSelection &&
+            !(loading && historyKey(evt.key))) {
           if (evt.key.code == sfKeyLeft) {
             nrVcsDecr = 1;
             waitEvt = 0;
@@ -589,18 +3230,38 @@ int main(int argc, char **argv) {
             sfClock_restart(g.unredoClock);
           } else if (evt.key.code == sfKeyS) {
             if (evt.key.control) {
-              save(g.vxa, nrVcs, winsize);
+              saveDue = 1;
+            } else {
+              selector = !selector;
+              ruler = circle = eraser = 0;
+              dropSelection(&g.editor, g.renderer);
             }
           } else if (evt.key.code == sfKeyE) {
             if (evt.key.control) {
-              exportSvg(g.vxa, nrVcs);
+              if (evt.key.shift) {
+                canvasDue = 1;
+              } else {
+                svgDue = 1;
+              }
+            } else {
+              eraser = !eraser;
+              ruler = circle = selector = 0;
+              dropSelection(&g.editor, g.renderer);
             }
           } else if (evt.key.code == sfKeyW) {
             ruler = !ruler;
-            circle = 0;
+            circle = eraser = selector = 0;
+            dropSelection(&g.editor, g.renderer);
           } else if (evt.key.code == sfKeyC) {
             circle = !circle;
-            ruler = 0;
+            ruler = eraser = selector = 0;
+            dropSelection(&g.editor, g.renderer);
+          } else if (evt.key.code == sfKeyDelete ||
+                     evt.key.code == sfKeyBackspace) {
+            deleteSelection(&g.editor, g.segColors, g.renderer);
+            sendOverlay(g.renderer, g.editor.selBox, 0);
+          } else if (evt.key.code == sfKeyEscape) {
+            dropSelection(&g.editor, g.renderer);
           } else if (evt.key.code == sfKeyR) {
             if (evt.key.alt) {
               nrVcs2draw = 0;
@@ -609,8 +3270,12 @@ int main(int argc, char **argv) {
             if (evt.key.alt) {
               nrVcs2draw = nrVcs;
             } else {
-              sfRenderWindow_setView(g.window,
-                                     sfRenderWindow_getDefaultView(g.window));
+              const sfView *defaultView =
+                  sfRenderWindow_getDefaultView(g.window);
+              sfView_setCenter(g.view, sfView_getCenter(defaultView));
+              sfView_setSize(g.view, sfView_getSize(defaultView));
+              sfView_setRotation(g.view, sfView_getRotation(defaultView));
+              viewChanged = 1;
             }
           } else if (evt.key.code == sfKeyZ) {
             if (evt.key.control) {
@@ -641,16 +3306,14 @@ int main(int argc, char **argv) {
             sfClock_restart(g.rotateClock);
           } else if (evt.key.code == sfKeyB) {
             if (evt.key.control) {
-              drawCross = !drawCross;
+              struct Command cmd;
+              memset(&cmd, 0, sizeof(cmd));
+              cmd.type = CMD_CROSS;
+              cmd.flag = drawCross = !drawCross;
+              sendCommand(g.renderer, &cmd);
             } else {
-              sfView *view = sfView_copy(sfRenderWindow_getView(g.window));
-              if (!view) {
-                cleanGarbage(g);
-                return EXIT_FAILURE;
-              }
-              sfView_setSize(view, (sfVector2f){winsize.x, winsize.y});
-              sfRenderWindow_setView(g.window, view);
-              sfView_destroy(view);
+              sfView_setSize(g.view, (sfVector2f){winsize.x, winsize.y});
+              viewChanged = 1;
             }
           }
         }
@@ -676,6 +3339,12 @@ int main(int argc, char **argv) {
         } else if (evt.key.code == sfKeyNum9) {
           color = (sfColor){255, 0, 0, 255};
         }
+        // the loader hands out palette indices until it is done
+        if (evt.key.code >= sfKeyNum0 && evt.key.code <= sfKeyNum9 &&
+            !movingSelection && !loading) {
+          recolourSelection(&g.editor, g.segColors, g.renderer,
+                            paletteIndex(&g.palette, color));
+        }
         break;
       case sfEvtKeyReleased:
         if (evt.key.code == sfKeyLeft || evt.key.code == sfKeyRight ||
@@ -708,6 +3377,24 @@ int main(int argc, char **argv) {
       }
     }
 
+    if (loading) {
+      sfMutex_lock(g.loader->mutex);
+      g.editor.nrLoaded = g.loader->nrParsed;
+      if (g.loader->done) {
+        nrVcs = nrVcs2draw = g.loader->nrParsed;
+        loading = 0;
+      }
+      sfMutex_unlock(g.loader->mutex);
+    }
+
+    // the index catches up a slice at a time, hit tests complete it first
+    size_t nrIndexable = loading ? g.editor.nrLoaded : nrVcs;
+    if (!indexVertices(&g.editor, g.vxa, g.segColors,
+                       lmin(nrIndexable, g.editor.nrIndexed + INDEX_BUDGET))) {
+      cleanGarbage(g);
+      return EXIT_FAILURE;
+    }
+
     if (nrVcsDecr) {
       size_t delta = sfClock_restart(g.unredoClock).microseconds;
       delta *= 2;
@@ -743,66 +3430,89 @@ int main(int argc, char **argv) {
     }
 
     if (zoomIncr) {
-      sfView *view = sfView_copy(sfRenderWindow_getView(g.window));
-      if (!view) {
-        cleanGarbage(g);
-        return EXIT_FAILURE;
-      }
-
       sfTime time = sfClock_restart(g.zoomClock);
-      sfView_zoom(view, exp(time.microseconds / 1000000.f));
-      sfRenderWindow_setView(g.window, view);
-      sfView_destroy(view);
+      sfView_zoom(g.view, exp(time.microseconds / 1000000.f));
+      viewChanged = 1;
     } else if (zoomDecr) {
-      sfView *view = sfView_copy(sfRenderWindow_getView(g.window));
-      if (!view) {
-        cleanGarbage(g);
-        return EXIT_FAILURE;
-      }
       sfTime time = sfClock_restart(g.zoomClock);
-      sfView_zoom(view, exp(-time.microseconds / 1000000.f));
-      sfRenderWindow_setView(g.window, view);
-      sfView_destroy(view);
+      sfView_zoom(g.view, exp(-time.microseconds / 1000000.f));
+      viewChanged = 1;
     }
 
     if (rotateLeft) {
-      sfView *view = sfView_copy(sfRenderWindow_getView(g.window));
-      if (!view) {
-        cleanGarbage(g);
-        return EXIT_FAILURE;
-      }
       sfTime time = sfClock_restart(g.rotateClock);
-      sfView_rotate(view, time.microseconds / 1000000.f * 80);
-      sfRenderWindow_setView(g.window, view);
-      sfView_destroy(view);
+      sfView_rotate(g.view, time.microseconds / 1000000.f * 80);
+      viewChanged = 1;
     } else if (rotateRight) {
-      sfView *view = sfView_copy(sfRenderWindow_getView(g.window));
-      if (!view) {
+      sfTime time = sfClock_restart(g.rotateClock);
+      sfView_rotate(g.view, -time.microseconds / 1000000.f * 80);
+      viewChanged = 1;
+    }
+
+    if (!sfRenderWindow_isOpen(g.window)) {
+      break;
+    }
+
+    // a compaction step per iteration once the render thread took up the
+    // previous one, and right away when the drawing is to be written
+    int writeDue = saveDue || svgDue || canvasDue;
+    if (!loading && !drawing && !erasing && !selecting && !movingSelection &&
+        !nrVcsDecr && !nrVcsIncr && !nrVcsFineDecr && !nrVcsFineIncr &&
+        ringEmpty(&g.renderer->ring) &&
+        (writeDue ||
+         (compactionDue(&g.editor, nrVcs) &&
+          sfClock_getElapsedTime(g.idleClock).microseconds >= 1000000))) {
+      if (!compactSlice(&g.editor, g.vxa, g.segColors, g.renderer, &nrVcs,
+                        &nrVcs2draw, &lastUpdatedNrVcs2draw, &g.undos,
+                        COMPACT_SLICE)) {
         cleanGarbage(g);
         return EXIT_FAILURE;
       }
+    }
+    if (writeDue && !g.editor.nrDead) {
+      if (saveDue) {
+        save(g.vxa, g.segColors, &g.palette, nrVcs, winsize);
+      }
+      if (svgDue) {
+        exportSvg(g.vxa, g.segColors, &g.palette, nrVcs);
+      }
+      if (canvasDue) {
+        exportCanvas(g.vxa, g.segColors, &g.palette, nrVcs);
+      }
+      saveDue = svgDue = canvasDue = 0;
+    }
 
-      sfTime time = sfClock_restart(g.rotateClock);
-      sfView_rotate(view, -time.microseconds / 1000000.f * 80);
-      sfRenderWindow_setView(g.window, view);
-      sfView_destroy(view);
+    struct Command cmd;
+    memset(&cmd, 0, sizeof(cmd));
+
+    if (viewChanged) {
+      cmd.type = CMD_VIEW;
+      cmd.center = sfView_getCenter(g.view);
+      cmd.size = sfView_getSize(g.view);
+      cmd.rotation = sfView_getRotation(g.view);
+      sendCommand(g.renderer, &cmd);
+      viewChanged = 0;
     }
 
-    sfRenderWindow_clear(g.window, (sfColor){18, 20, 31, 255});
-    sfView *view = sfView_copy(sfRenderWindow_getView(g.window));
-    if (!view) {
+    int idle = !drawing && !nrVcsDecr && !nrVcsIncr && !nrVcsFineDecr &&
+               !nrVcsFineIncr;
+    if (nrVcs2draw != sentNrVcs2draw || idle != sentIdle) {
+      cmd.type = CMD_HISTORY;
+      cmd.count = sentNrVcs2draw = nrVcs2draw;
+      cmd.flag = sentIdle = idle;
+      sendCommand(g.renderer, &cmd);
+    }
+
+    if (atomic_load(&g.renderer->failed)) {
       cleanGarbage(g);
       return EXIT_FAILURE;
     }
-    sfRenderWindow_drawVertexBufferRange(g.window, g.vxb, 0, nrVcs2draw, NULL);
 
-    if (drawCross) {
-      sfRenderWindow_setView(g.window, sfRenderWindow_getDefaultView(g.window));
-      sfRenderWindow_drawPrimitives(g.window, centerVxs, 4, sfLines, NULL);
-      sfRenderWindow_setView(g.window, view);
+    // continuous actions are driven by clocks, there is no frame to wait for
+    if (!waitEvt || loading || editorPending(&g.editor, nrVcs) || saveDue ||
+        svgDue || canvasDue) {
+      sfSleep(sfMilliseconds(1));
     }
-    sfRenderWindow_display(g.window);
-    sfView_destroy(view);
   }
 
   cleanGarbage(g);
@@ -0,0 +1,435 @@
+#include "vxops.h"
+#include <math.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define VX_X86 1
+#include <immintrin.h>
+#else
+#define VX_X86 0
+#endif
+
+#define lmin(x, y) (((x) < (y)) ? (x) : (y))
+#define lmax(x, y) (((x) < (y)) ? (y) : (x))
+
+// The vector versions treat the vertices as a flat array of 32-bit lanes
+// going x, y, x, y...
+_Static_assert(sizeof(struct DrawVertex) == 2 * sizeof(float),
+               "vertices must be two packed 32-bit lanes");
+
+static enum VxLevel levelLimit = VX_AVX2;
+
+enum VxLevel vxLevel(void) {
+#if VX_X86
+  if (levelLimit >= VX_AVX2 && __builtin_cpu_supports("avx2")) {
+    return VX_AVX2;
+  }
+  if (levelLimit >= VX_SSE2 && __builtin_cpu_supports("sse2")) {
+    return VX_SSE2;
+  }
+#endif
+  return VX_SCALAR;
+}
+
+void vxLimitLevel(enum VxLevel level) { levelLimit = level; }
+
+static void boundsScalar(const struct DrawVertex *vxs, size_t n,
+                         sfVector2f *lo, sfVector2f *hi) {
+  sfVector2f l = *lo;
+  sfVector2f h = *hi;
+  for (size_t i = 0; i < n; ++i) {
+    l.x = lmin(l.x, vxs[i].position.x);
+    l.y = lmin(l.y, vxs[i].position.y);
+    h.x = lmax(h.x, vxs[i].position.x);
+    h.y = lmax(h.y, vxs[i].position.y);
+  }
+  *lo = l;
+  *hi = h;
+}
+
+static void transformScalar(const struct DrawVertex *vxs, size_t n,
+                            sfVector2f origin, float scale,
+                            struct DrawVertex *out) {
+  for (size_t i = 0; i < n; ++i) {
+    out[i].position.x = (vxs[i].position.x - origin.x) * scale;
+    out[i].position.y = (vxs[i].position.y - origin.y) * scale;
+  }
+}
+
+static void quantiseScalar(const struct DrawVertex *vxs, size_t n,
+                           sfVector2f origin, float step, int32_t *out) {
+  for (size_t i = 0; i < n; ++i) {
+    out[2 * i] = (int32_t)lrintf((vxs[i].position.x - origin.x) / step);
+    out[2 * i + 1] = (int32_t)lrintf((vxs[i].position.y - origin.y) / step);
+  }
+}
+
+static void packScalar(const struct DrawVertex *vxs, const uint32_t *colors,
+                       size_t n, uint32_t *records) {
+  for (size_t i = 0; i < n; ++i) {
+    memcpy(&records[3 * i], &vxs[i].position, 2 * sizeof(uint32_t));
+    records[3 * i + 2] = colors[i];
+  }
+}
+
+static void unpackScalar(const uint32_t *records, size_t n,
+                         struct DrawVertex *vxs, uint32_t *colors) {
+  for (size_t i = 0; i < n; ++i) {
+    memcpy(&vxs[i].position, &records[3 * i], 2 * sizeof(uint32_t));
+    colors[i] = records[3 * i + 2];
+  }
+}
+
+#if VX_X86
+
+// Four .draw records in three registers to the positions x0 y0 x1 y1,
+// x2 y2 x3 y3
+__attribute__((target("sse2"))) static inline void
+positionsSse2(__m128 r0, __m128 r1, __m128 r2, __m128 *p0, __m128 *p1) {
+  __m128 t = _mm_shuffle_ps(r0, r1, _MM_SHUFFLE(0, 0, 3, 3));
+  *p0 = _mm_shuffle_ps(r0, t, _MM_SHUFFLE(2, 0, 1, 0));
+  *p1 = _mm_shuffle_ps(r1, r2, _MM_SHUFFLE(2, 1, 3, 2));
+}
+
+__attribute__((target("sse2"))) static void
+boundsSse2(const struct DrawVertex *vxs, size_t n, sfVector2f *lo,
+           sfVector2f *hi) {
+  size_t bulk = n / 4 * 4;
+  __m128 mn = _mm_setr_ps(lo->x, lo->y, lo->x, lo->y);
+  __m128 mx = _mm_setr_ps(hi->x, hi->y, hi->x, hi->y);
+  for (size_t i = 0; i < bulk; i += 4) {
+    __m128 p0 = _mm_loadu_ps((const float *)&vxs[i]);
+    __m128 p1 = _mm_loadu_ps((const float *)&vxs[i + 2]);
+    mn = _mm_min_ps(_mm_min_ps(mn, p0), p1);
+    mx = _mm_max_ps(_mm_max_ps(mx, p0), p1);
+  }
+  mn = _mm_min_ps(mn, _mm_movehl_ps(mn, mn));
+  mx = _mm_max_ps(mx, _mm_movehl_ps(mx, mx));
+  float lanes[4];
+  _mm_storeu_ps(lanes, mn);
+  lo->x = lanes[0];
+  lo->y = lanes[1];
+  _mm_storeu_ps(lanes, mx);
+  hi->x = lanes[0];
+  hi->y = lanes[1];
+  boundsScalar(vxs + bulk, n - bulk, lo, hi);
+}
+
+__attribute__((target("sse2"))) static void
+transformSse2(const struct DrawVertex *vxs, size_t n, sfVector2f origin,
+              float scale, struct DrawVertex *out) {
+  size_t bulk = n / 4 * 4;
+  __m128 off = _mm_setr_ps(origin.x, origin.y, origin.x, origin.y);
+  __m128 sc = _mm_set1_ps(scale);
+  for (size_t i = 0; i < bulk; i += 4) {
+    const float *src = (const float *)&vxs[i];
+    float *dst = (float *)&out[i];
+    __m128 p0 = _mm_loadu_ps(src);
+    __m128 p1 = _mm_loadu_ps(src + 4);
+    _mm_storeu_ps(dst, _mm_mul_ps(_mm_sub_ps(p0, off), sc));
+    _mm_storeu_ps(dst + 4, _mm_mul_ps(_mm_sub_ps(p1, off), sc));
+  }
+  transformScalar(vxs + bulk, n - bulk, origin, scale, out + bulk);
+}
+
+__attribute__((target("sse2"))) static void
+quantiseSse2(const struct DrawVertex *vxs, size_t n, sfVector2f origin,
+             float step, int32_t *out) {
+  size_t bulk = n / 4 * 4;
+  __m128 off = _mm_setr_ps(origin.x, origin.y, origin.x, origin.y);
+  __m128 st = _mm_set1_ps(step);
+  for (size_t i = 0; i < bulk; i += 4) {
+    __m128 p0 = _mm_loadu_ps((const float *)&vxs[i]);
+    __m128 p1 = _mm_loadu_ps((const float *)&vxs[i + 2]);
+    __m128i q0 = _mm_cvtps_epi32(_mm_div_ps(_mm_sub_ps(p0, off), st));
+    __m128i q1 = _mm_cvtps_epi32(_mm_div_ps(_mm_sub_ps(p1, off), st));
+    _mm_storeu_si128((__m128i *)&out[2 * i], q0);
+    _mm_storeu_si128((__m128i *)&out[2 * i + 4], q1);
+  }
+  quantiseScalar(vxs + bulk, n - bulk, origin, step, out + 2 * bulk);
+}
+
+// Interleaves the colours of four vertices with their positions
+__attribute__((target("sse2"))) static void
+packSse2(const struct DrawVertex *vxs, const uint32_t *colors, size_t n,
+         uint32_t *records) {
+  size_t bulk = n / 4 * 4;
+  for (size_t i = 0; i < bulk; i += 4) {
+    __m128 p0 = _mm_loadu_ps((const float *)&vxs[i]);
+    __m128 p1 = _mm_loadu_ps((const float *)&vxs[i + 2]);
+    __m128 c = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)&colors[i]));
+    float *dst = (float *)&records[3 * i];
+    // x0 y0 c0 x1, y1 c1 x2 y2, c2 x3 y3 c3
+    __m128 t = _mm_shuffle_ps(c, p0, _MM_SHUFFLE(2, 2, 0, 0));
+    _mm_storeu_ps(dst, _mm_shuffle_ps(p0, t, _MM_SHUFFLE(2, 0, 1, 0)));
+    t = _mm_shuffle_ps(p0, c, _MM_SHUFFLE(1, 1, 3, 3));
+    _mm_storeu_ps(dst + 4, _mm_shuffle_ps(t, p1, _MM_SHUFFLE(1, 0, 2, 0)));
+    t = _mm_shuffle_ps(c, p1, _MM_SHUFFLE(2, 2, 2, 2));
+    __m128 u = _mm_shuffle_ps(p1, c, _MM_SHUFFLE(3, 3, 3, 3));
+    _mm_storeu_ps(dst + 8, _mm_shuffle_ps(t, u, _MM_SHUFFLE(2, 0, 2, 0)));
+  }
+  packScalar(vxs + bulk, colors + bulk, n - bulk, records + 3 * bulk);
+}
+
+__attribute__((target("sse2"))) static void
+unpackSse2(const uint32_t *records, size_t n, struct DrawVertex *vxs,
+           uint32_t *colors) {
+  size_t bulk = n / 4 * 4;
+  for (size_t i = 0; i < bulk; i += 4) {
+    const float *src = (const float *)&records[3 * i];
+    __m128 r0 = _mm_loadu_ps(src);
+    __m128 r1 = _mm_loadu_ps(src + 4);
+    __m128 r2 = _mm_loadu_ps(src + 8);
+    __m128 p0, p1;
+    positionsSse2(r0, r1, r2, &p0, &p1);
+    _mm_storeu_ps((float *)&vxs[i], p0);
+    _mm_storeu_ps((float *)&vxs[i + 2], p1);
+    __m128 t = _mm_shuffle_ps(r0, r1, _MM_SHUFFLE(1, 1, 2, 2));
+    __m128 u = _mm_shuffle_ps(r2, r2, _MM_SHUFFLE(3, 3, 0, 0));
+    _mm_storeu_si128((__m128i *)&colors[i],
+                     _mm_castps_si128(
+                         _mm_shuffle_ps(t, u, _MM_SHUFFLE(2, 0, 2, 0))));
+  }
+  unpackScalar(records + 3 * bulk, n - bulk, vxs + bulk, colors + bulk);
+}
+
+__attribute__((target("avx2"))) static void
+boundsAvx2(const struct DrawVertex *vxs, size_t n, sfVector2f *lo,
+           sfVector2f *hi) {
+  size_t bulk = n / 8 * 8;
+  __m256 mn = _mm256_setr_ps(lo->x, lo->y, lo->x, lo->y, lo->x, lo->y, lo->x,
+                             lo->y);
+  __m256 mx = _mm256_setr_ps(hi->x, hi->y, hi->x, hi->y, hi->x, hi->y, hi->x,
+                             hi->y);
+  for (size_t i = 0; i < bulk; i += 8) {
+    __m256 p0 = _mm256_loadu_ps((const float *)&vxs[i]);
+    __m256 p1 = _mm256_loadu_ps((const float *)&vxs[i + 4]);
+    mn = _mm256_min_ps(_mm256_min_ps(mn, p0), p1);
+    mx = _mm256_max_ps(_mm256_max_ps(mx, p0), p1);
+  }
+  __m128 mn4 = _mm_min_ps(_mm256_castps256_ps128(mn),
+                          _mm256_extractf128_ps(mn, 1));
+  __m128 mx4 = _mm_max_ps(_mm256_castps256_ps128(mx),
+                          _mm256_extractf128_ps(mx, 1));
+  mn4 = _mm_min_ps(mn4, _mm_movehl_ps(mn4, mn4));
+  mx4 = _mm_max_ps(mx4, _mm_movehl_ps(mx4, mx4));
+  float lanes[4];
+  _mm_storeu_ps(lanes, mn4);
+  lo->x = lanes[0];
+  lo->y = lanes[1];
+  _mm_storeu_ps(lanes, mx4);
+  hi->x = lanes[0];
+  hi->y = lanes[1];
+  boundsScalar(vxs + bulk, n - bulk, lo, hi);
+}
+
+__attribute__((target("avx2"))) static void
+transformAvx2(const struct DrawVertex *vxs, size_t n, sfVector2f origin,
+              float scale, struct DrawVertex *out) {
+  size_t bulk = n / 8 * 8;
+  __m256 off = _mm256_setr_ps(origin.x, origin.y, origin.x, origin.y,
+                              origin.x, origin.y, origin.x, origin.y);
+  __m256 sc = _mm256_set1_ps(scale);
+  for (size_t i = 0; i < bulk; i += 8) {
+    const float *src = (const float *)&vxs[i];
+    float *dst = (float *)&out[i];
+    __m256 p0 = _mm256_loadu_ps(src);
+    __m256 p1 = _mm256_loadu_ps(src + 8);
+    _mm256_storeu_ps(dst, _mm256_mul_ps(_mm256_sub_ps(p0, off), sc));
+    _mm256_storeu_ps(dst + 8, _mm256_mul_ps(_mm256_sub_ps(p1, off), sc));
+  }
+  transformScalar(vxs + bulk, n - bulk, origin, scale, out + bulk);
+}
+
+__attribute__((target("avx2"))) static void
+quantiseAvx2(const struct DrawVertex *vxs, size_t n, sfVector2f origin,
+             float step, int32_t *out) {
+  size_t bulk = n / 8 * 8;
+  __m256 off = _mm256_setr_ps(origin.x, origin.y, origin.x, origin.y,
+                              origin.x, origin.y, origin.x, origin.y);
+  __m256 st = _mm256_set1_ps(step);
+  for (size_t i = 0; i < bulk; i += 8) {
+    __m256 p0 = _mm256_loadu_ps((const float *)&vxs[i]);
+    __m256 p1 = _mm256_loadu_ps((const float *)&vxs[i + 4]);
+    __m256i q0 = _mm256_cvtps_epi32(_mm256_div_ps(_mm256_sub_ps(p0, off), st));
+    __m256i q1 = _mm256_cvtps_epi32(_mm256_div_ps(_mm256_sub_ps(p1, off), st));
+    _mm256_storeu_si256((__m256i *)&out[2 * i], q0);
+    _mm256_storeu_si256((__m256i *)&out[2 * i + 8], q1);
+  }
+  quantiseScalar(vxs + bulk, n - bulk, origin, step, out + 2 * bulk);
+}
+
+// Eight records take three registers, each lane of which comes from the
+// first or second register of positions or from the colours, with the
+// index of the lane it comes from
+static const int32_t packSource[3][8] = {{0, 0, 2, 0, 0, 2, 0, 0},
+                                         {2, 0, 0, 2, 1, 1, 2, 1},
+                                         {1, 2, 1, 1, 2, 1, 1, 2}};
+static const int32_t packLane[3][8] = {{0, 1, 0, 2, 3, 1, 4, 5},
+                                       {2, 6, 7, 3, 0, 1, 4, 2},
+                                       {3, 5, 4, 5, 6, 6, 7, 7}};
+
+// Interleaves the colours of eight vertices with their positions
+__attribute__((target("avx2"))) static void
+packAvx2(const struct DrawVertex *vxs, const uint32_t *colors, size_t n,
+         uint32_t *records) {
+  size_t bulk = n / 8 * 8;
+  __m256i order[3];
+  __m256 second[3], color[3];
+  for (int j = 0; j < 3; ++j) {
+    __m256i source = _mm256_loadu_si256((const __m256i *)packSource[j]);
+    order[j] = _mm256_loadu_si256((const __m256i *)packLane[j]);
+    second[j] = _mm256_castsi256_ps(
+        _mm256_cmpeq_epi32(source, _mm256_set1_epi32(1)));
+    color[j] = _mm256_castsi256_ps(
+        _mm256_cmpeq_epi32(source, _mm256_set1_epi32(2)));
+  }
+  for (size_t i = 0; i < bulk; i += 8) {
+    __m256 p0 = _mm256_loadu_ps((const float *)&vxs[i]);
+    __m256 p1 = _mm256_loadu_ps((const float *)&vxs[i + 4]);
+    __m256 c = _mm256_castsi256_ps(
+        _mm256_loadu_si256((const __m256i *)&colors[i]));
+    float *dst = (float *)&records[3 * i];
+    for (int j = 0; j < 3; ++j) {
+      __m256 r = _mm256_blendv_ps(_mm256_permutevar8x32_ps(p0, order[j]),
+                                  _mm256_permutevar8x32_ps(p1, order[j]),
+                                  second[j]);
+      r = _mm256_blendv_ps(r, _mm256_permutevar8x32_ps(c, order[j]),
+                           color[j]);
+      _mm256_storeu_ps(dst + 8 * j, r);
+    }
+  }
+  packScalar(vxs + bulk, colors + bulk, n - bulk, records + 3 * bulk);
+}
+
+__attribute__((target("avx2"))) static void
+unpackAvx2(const uint32_t *records, size_t n, struct DrawVertex *vxs,
+           uint32_t *colors) {
+  size_t bulk = n / 8 * 8;
+  for (size_t i = 0; i < bulk; i += 8) {
+    const float *src = (const float *)&records[3 * i];
+    __m256 r0 = _mm256_loadu_ps(src);
+    __m256 r1 = _mm256_loadu_ps(src + 8);
+    __m256 r2 = _mm256_loadu_ps(src + 16);
+    // x0 y0 .. x3 y3 and x4 y4 .. x7 y7
+    __m256 p0 = _mm256_blend_ps(
+        _mm256_permutevar8x32_ps(r0,
+                                 _mm256_setr_epi32(0, 1, 3, 4, 6, 7, 0, 0)),
+        _mm256_permutevar8x32_ps(r1,
+                                 _mm256_setr_epi32(0, 0, 0, 0, 0, 0, 1, 2)),
+        0xc0);
+    __m256 p1 = _mm256_blend_ps(
+        _mm256_permutevar8x32_ps(r1,
+                                 _mm256_setr_epi32(4, 5, 7, 0, 0, 0, 0, 0)),
+        _mm256_permutevar8x32_ps(r2,
+                                 _mm256_setr_epi32(0, 0, 0, 0, 2, 3, 5, 6)),
+        0xf8);
+    __m256 c = _mm256_blend_ps(
+        _mm256_permutevar8x32_ps(r0,
+                                 _mm256_setr_epi32(2, 5, 0, 0, 0, 0, 0, 0)),
+        _mm256_permutevar8x32_ps(r1,
+                                 _mm256_setr_epi32(0, 0, 0, 3, 6, 0, 0, 0)),
+        0x1c);
+    c = _mm256_blend_ps(
+        c,
+        _mm256_permutevar8x32_ps(r2,
+                                 _mm256_setr_epi32(0, 0, 0, 0, 0, 1, 4, 7)),
+        0xe0);
+    _mm256_storeu_ps((float *)&vxs[i], p0);
+    _mm256_storeu_ps((float *)&vxs[i + 4], p1);
+    _mm256_storeu_si256((__m256i *)&colors[i], _mm256_castps_si256(c));
+  }
+  unpackScalar(records + 3 * bulk, n - bulk, vxs + bulk, colors + bulk);
+}
+
+#endif
+
+void vxBounds(const struct DrawVertex *vxs, size_t n, sfVector2f *lo,
+              sfVector2f *hi) {
+  if (!n) {
+    lo->x = lo->y = hi->x = hi->y = 0;
+    return;
+  }
+  *lo = *hi = vxs[0].position;
+#if VX_X86
+  switch (vxLevel()) {
+  case VX_AVX2:
+    boundsAvx2(vxs, n, lo, hi);
+    return;
+  case VX_SSE2:
+    boundsSse2(vxs, n, lo, hi);
+    return;
+  default:
+    break;
+  }
+#endif
+  boundsScalar(vxs, n, lo, hi);
+}
+
+void vxTransform(const struct DrawVertex *vxs, size_t n, sfVector2f origin,
+                 float scale, struct DrawVertex *out) {
+#if VX_X86
+  switch (vxLevel()) {
+  case VX_AVX2:
+    transformAvx2(vxs, n, origin, scale, out);
+    return;
+  case VX_SSE2:
+    transformSse2(vxs, n, origin, scale, out);
+    return;
+  default:
+    break;
+  }
+#endif
+  transformScalar(vxs, n, origin, scale, out);
+}
+
+void vxQuantise(const struct DrawVertex *vxs, size_t n, sfVector2f origin,
+                float step, int32_t *out) {
+#if VX_X86
+  switch (vxLevel()) {
+  case VX_AVX2:
+    quantiseAvx2(vxs, n, origin, step, out);
+    return;
+  case VX_SSE2:
+    quantiseSse2(vxs, n, origin, step, out);
+    return;
+  default:
+    break;
+  }
+#endif
+  quantiseScalar(vxs, n, origin, step, out);
+}
+
+void vxPack(const struct DrawVertex *vxs, const uint32_t *colors, size_t n,
+            uint32_t *records) {
+#if VX_X86
+  switch (vxLevel()) {
+  case VX_AVX2:
+    packAvx2(vxs, colors, n, records);
+    return;
+  case VX_SSE2:
+    packSse2(vxs, colors, n, records);
+    return;
+  default:
+    break;
+  }
+#endif
+  packScalar(vxs, colors, n, records);
+}
+
+void vxUnpack(const uint32_t *records, size_t n, struct DrawVertex *vxs,
+              uint32_t *colors) {
+#if VX_X86
+  switch (vxLevel()) {
+  case VX_AVX2:
+    unpackAvx2(records, n, vxs, colors);
+    return;
+  case VX_SSE2:
+    unpackSse2(records, n, vxs, colors);
+    return;
+  default:
+    break;
+  }
+#endif
+  unpackScalar(records, n, vxs, colors);
+}
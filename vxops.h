@@ -0,0 +1,44 @@
+#ifndef VXOPS_H
+#define VXOPS_H
+
+#include <SFML/System/Vector2.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// sfVertex without the texture coordinates, which are never used, nor the
+// colour: both vertices of a segment share it, so it lives next to them as
+// a 16-bit palette index per segment. 9 bytes per vertex against 20.
+struct DrawVertex {
+  sfVector2f position;
+};
+
+// Whole-array passes over vertices. Each one has a scalar, an SSE2 and an
+// AVX2 version; the best one the CPU supports is picked on every call.
+enum VxLevel { VX_SCALAR, VX_SSE2, VX_AVX2 };
+
+enum VxLevel vxLevel(void);
+
+// Caps the level picked from now on, meant for benchmarks
+void vxLimitLevel(enum VxLevel level);
+
+// Bounding box of the positions, both corners are zero for no vertices
+void vxBounds(const struct DrawVertex *vxs, size_t n, sfVector2f *lo,
+              sfVector2f *hi);
+
+// out[i].position = (vxs[i].position - origin) * scale, out may be vxs
+void vxTransform(const struct DrawVertex *vxs, size_t n, sfVector2f origin,
+                 float scale, struct DrawVertex *out);
+
+// out[2 * i], out[2 * i + 1] = round((vxs[i].position - origin) / step)
+void vxQuantise(const struct DrawVertex *vxs, size_t n, sfVector2f origin,
+                float step, int32_t *out);
+
+// Records of the .draw format: the bits of x and y followed by
+// sfColor_toInteger of the colour, three words per vertex. The colours go
+// in and out as a word per vertex.
+void vxPack(const struct DrawVertex *vxs, const uint32_t *colors, size_t n,
+            uint32_t *records);
+void vxUnpack(const uint32_t *records, size_t n, struct DrawVertex *vxs,
+              uint32_t *colors);
+
+#endif